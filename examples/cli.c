@@ -49,7 +49,7 @@ static char *my_rl_complete(char *token, int *match)
 
     if (count == 1) {
 	*match = 1;
-	return strdup(list[index] + matchlen);
+	return el_strdup(list[index] + matchlen);
     }
 
     return NULL;
@@ -67,10 +67,10 @@ static int my_rl_list_possib(char *token, char ***av)
     if (!num)
 	return 0;
 
-    copy = malloc(num * sizeof(char *));
+    copy = el_malloc(num * sizeof(char *));
     for (i = 0; i < num; i++) {
 	if (!strncmp(list[i], token, strlen (token))) {
-	    copy[total] = strdup(list[i]);
+	    copy[total] = el_strdup(list[i]);
 	    total++;
 	}
     }
@@ -87,13 +87,12 @@ el_status_t list_possible(void)
 
     word = el_find_word();
     ac = rl_list_possib(word, &av);
-    if (word)
-        free(word);
+    el_free(word);
     if (ac) {
         el_print_columns(ac, av);
         while (--ac >= 0)
-            free(av[ac]);
-        free(av);
+            el_free(av[ac]);
+        el_free(av);
 
         return CSmove;
     }
@@ -101,10 +100,13 @@ el_status_t list_possible(void)
     return el_ring_bell();
 }
 
+/* Key functions that print must redraw the line after it */
 el_status_t do_suspend(void)
 {
-    puts("Abort!");
-    return CSstay;
+    puts("\nAbort!");
+    rl_forced_update_display();
+
+    return CSmove;
 }
 
 static void breakit(int signo)
@@ -124,7 +126,7 @@ static int unlock(const char *passwd)
 
     while ((line = readline(prompt))) {
 	rc = strncmp(line, passwd, strlen(passwd));
-	free(line);
+	el_free(line);
 
 	if (rc) {
 	    printf("\nWrong password, please try again, it's secret.\n");
@@ -157,14 +159,14 @@ int main(void)
 
     while ((line = readline(prompt))) {
 	if (!strncmp(line, "unlock", 6) && unlock("secret")) {
-	    free(line);
+	    el_free(line);
 	    fprintf(stderr, "\nSecurity breach, user logged out!\n");
 	    break;
 	}
 
 	if (*line != '\0')
 	    printf("\t\t\t|%s|\n", line);
- 	free(line);
+ 	el_free(line);
     }
 
     write_history(HISTORY);
@@ -120,18 +120,38 @@ main()
     }
 
 //    rl_add_defun("change-prompt", change_prompt, CTRL('t'));
+#ifdef EDITLINE_LIBRARY
+    /* Handle a whole paste per wakeup, not one read() of it */
+    el_callback_drain = 1;
+#endif
     rl_callback_handler_install(get_prompt(), process_line);
 
     while(1) {
+      struct timeval tv, *tvp = NULL;
+      int ms, rc;
+
       FD_ZERO(&fds);
       FD_SET(fileno(stdin), &fds);
 
-      if( select(FD_SETSIZE, &fds, NULL, NULL, NULL) < 0) {
+      /* Wake up to time out a lone ESC, or a partial escape sequence */
+#ifdef EDITLINE_LIBRARY
+      ms = el_callback_timeout();
+#else
+      ms = -1;
+#endif
+      if( ms >= 0 ) {
+        tv.tv_sec  = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        tvp = &tv;
+      }
+
+      rc = select(FD_SETSIZE, &fds, NULL, NULL, tvp);
+      if( rc < 0) {
         perror("select");
         exit(1);
       }
 
-      if( FD_ISSET(fileno(stdin), &fds) ) {
+      if( rc == 0 || FD_ISSET(fileno(stdin), &fds) ) {
         rl_callback_read_char();
       }
     }
@@ -161,7 +181,7 @@ process_line(char *line)
     fprintf(stderr, "|%s|\n", line);
   }
 
-  free (line);
+  el_free (line);
 }
 
 int
@@ -111,7 +111,7 @@ int main(int argc, char **argv)
 #else
 	execute_line(s);
 #endif
-	free(line);
+	el_free(line);
     }
 
     puts("");
@@ -295,7 +295,7 @@ char *command_generator(const char *text, int state)
 	list_index++;
 
 	if (strncmp(name, text, len) == 0)
-	    return strdup(name);
+	    return el_strdup(name);
     }
 
     /* If no names matched, then return NULL. */
@@ -61,7 +61,7 @@ int main(int argc, char *argv[] __attribute__ ((unused)))
 		perror(p);
 	    }
 	}
-	free(p);
+	el_free(p);
     }
 
     write_history(".testit_history");
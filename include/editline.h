@@ -22,6 +22,7 @@
 #define EDITLINE_H_
 
 #include <stdio.h>
+#include "editline-config.h"
 
 /* Handy macros when binding keys. */
 #define CTL(x)          ((x) & 0x1F)
@@ -31,6 +32,14 @@
 #define ISMETA(x)       ((x) & 0x80)
 #define UNMETA(x)       ((x) & 0x7F)
 
+/* Built with --enable-thread-local, see editline-config.h, each thread
+ * has its own default session and line variables */
+#ifdef EL_THREAD_LOCAL
+#define EL_TLS          __thread
+#else
+#define EL_TLS
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,22 +63,43 @@ typedef void rl_voidfunc_t(void);
 typedef void rl_vintfunc_t(int);
 typedef void rl_vcpfunc_t(char *);
 
+/* Allocator of all library memory, called with 'arg', see el_set_allocator() */
+typedef struct {
+    void *(*malloc_func) (void *arg, size_t size);
+    void *(*realloc_func)(void *arg, void *ptr, size_t size);
+    void  (*free_func)   (void *arg, void *ptr);
+    void   *arg;
+} el_allocator_t;
+
+/* An editing session, with its own terminal, line, history and keymaps */
+typedef struct el_session el_session_t;
+
+/* Drives many sessions from one thread, see el_loop_run() */
+typedef struct el_loop el_loop_t;
+
 /* FSF Readline compat tupes */
 typedef char  *rl_complete_func_t   (char *, int*);
 typedef char  *rl_compentry_func_t  (const char *, int);
 typedef char **rl_completion_func_t (const char *, int, int);
 
 /* Display 8-bit chars "as-is" or as `M-x'? Toggle with M-m. (Default:0 - "as-is") */
-extern int rl_meta_chars;
+extern EL_TLS int rl_meta_chars;
 
 /* Editline specific functions. */
 extern char *      el_find_word(void);
 extern void        el_print_columns(int ac, char **av);
+extern int         el_set_allocator(const el_allocator_t *allocator);
+extern void       *el_malloc(size_t size);
+extern char       *el_strdup(const char *s);
+extern void        el_free(void *ptr);
+
 extern el_status_t el_ring_bell(void);
 extern el_status_t el_del_char(void);
 
 extern el_status_t el_bind_key(int key, el_keymap_func_t function);
 extern el_status_t el_bind_key_in_metamap(int key, el_keymap_func_t function);
+extern el_status_t el_bind_escseq(const char *seq, el_keymap_func_t function);
+extern el_status_t el_bind_keyseq(const char *seq, el_keymap_func_t function);
 
 extern const char *el_next_hist(void);
 extern const char *el_prev_hist(void);
@@ -80,18 +110,21 @@ extern char      **rl_completion_matches(const char *token, rl_compentry_func_t
 extern char       *rl_filename_completion_function(const char *text, int state);
 
 /* For compatibility with FSF readline. */
-extern int         rl_point;
-extern int         rl_mark;
-extern int         rl_end;
+extern EL_TLS int         rl_point;
+extern EL_TLS int         rl_mark;
+extern EL_TLS int         rl_end;
 extern int         rl_inhibit_complete;
-extern int         rl_attempted_completion_over;
-extern char       *rl_line_buffer;
+extern EL_TLS int         rl_attempted_completion_over;
+extern EL_TLS char       *rl_line_buffer;
 extern const char *rl_readline_name;
-extern FILE       *rl_instream;  /* The stdio stream from which input is read. Defaults to stdin if NULL - Not supported yet! */
-extern FILE       *rl_outstream; /* The stdio stream to which output is flushed. Defaults to stdout if NULL - Not supported yet! */
+extern EL_TLS FILE       *rl_instream;  /* The stdio stream from which input is read. Defaults to stdin if NULL - Not supported yet! */
+extern EL_TLS FILE       *rl_outstream; /* The stdio stream to which output is flushed. Defaults to stdout if NULL - Not supported yet! */
 extern int         el_no_echo;   /* E.g under emacs, don't echo except prompt */
 extern int         el_no_hist;   /* Disable auto-save of and access to history -- e.g. for password prompts or wizards */
 extern int         el_hist_size; /* size of history scrollback buffer, default: 15 */
+extern int         el_no_bracketed_paste; /* Do not enable bracketed paste in the terminal */
+extern int         el_esc_timeout; /* ms to wait for the rest of an escape sequence, -1 forever, default: 500 */
+extern int         el_callback_drain; /* rl_callback_read_char() reads all input there is before returning */
 
 extern void  rl_initialize      (void);
 extern void  rl_reset_terminal  (const char *terminal_name);
@@ -126,7 +159,39 @@ extern rl_list_possib_func_t *rl_set_list_possib_func (rl_list_possib_func_t *fu
 /* Alternate interface to plain readline(), for event loops */
 extern void rl_callback_handler_install (const char *prompt, rl_vcpfunc_t *lhandler);
 extern void rl_callback_read_char       (void);
+extern void rl_callback_read_chars      (const char *buf, size_t len);
 extern void rl_callback_handler_remove  (void);
+extern int  el_callback_timeout         (void);
+extern size_t rl_output_pending         (void);
+
+/* Sessions, the functions above work on the current one, default: stdio */
+extern el_session_t *el_session_new     (int infd, int outfd);
+extern void          el_session_free    (el_session_t *s);
+extern el_session_t *el_session_set     (el_session_t *s);
+extern el_session_t *el_session_get     (void);
+extern void          el_session_set_data(el_session_t *s, void *data);
+extern void         *el_session_data    (el_session_t *s);
+
+extern char *el_session_readline        (el_session_t *s, const char *prompt);
+extern void  el_session_callback_handler_install (el_session_t *s, const char *prompt, rl_vcpfunc_t *lhandler);
+extern void  el_session_callback_read_char       (el_session_t *s);
+extern void  el_session_callback_read_chars      (el_session_t *s, const char *buf, size_t len);
+extern void  el_session_callback_handler_remove  (el_session_t *s);
+extern int   el_session_callback_timeout         (el_session_t *s);
+extern void  el_session_add_history     (el_session_t *s, const char *line);
+extern int   el_session_read_history    (el_session_t *s, const char *filename);
+extern int   el_session_write_history   (el_session_t *s, const char *filename);
+
+/* Messages from any thread, printed above the line being edited */
+extern int   el_session_post            (el_session_t *s, const char *msg);
+extern int   el_session_message_fd      (el_session_t *s);
+
+/* Event loop for many sessions, Linux only: the others get ENOSYS */
+extern el_loop_t *el_loop_new (void);
+extern void       el_loop_free(el_loop_t *loop);
+extern int        el_loop_add (el_loop_t *loop, el_session_t *s, const char *prompt, rl_vcpfunc_t *lhandler);
+extern int        el_loop_del (el_loop_t *loop, el_session_t *s);
+extern int        el_loop_run (el_loop_t *loop, int timeout);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,125 @@
+/* Memory allocation for editline library.
+ *
+ * Copyright (c) 1992, 1993  Simmule Turner and Rich Salz
+ * All rights reserved.
+ *
+ * This software is not subject to any license of the American Telephone
+ * and Telegraph Company or of the Regents of the University of California.
+ *
+ * Permission is granted to anyone to use this software for any purpose on
+ * any computer system, and to alter it and redistribute it freely, subject
+ * to the following restrictions:
+ * 1. The authors are not responsible for the consequences of use of this
+ *    software, no matter how awful, even if they arise from flaws in it.
+ * 2. The origin of this software must not be misrepresented, either by
+ *    explicit claim or by omission.  Since few users ever read sources,
+ *    credits must appear in the documentation.
+ * 3. Altered versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.  Since few users
+ *    ever read sources, credits must appear in the documentation.
+ * 4. This notice may not be removed or altered.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include "editline.h"
+
+static void *std_malloc(void *arg, size_t size)
+{
+    (void)arg;
+    return malloc(size);
+}
+
+static void *std_realloc(void *arg, void *ptr, size_t size)
+{
+    (void)arg;
+    return realloc(ptr, size);
+}
+
+static void std_free(void *arg, void *ptr)
+{
+    (void)arg;
+    free(ptr);
+}
+
+static const el_allocator_t std_allocator = {
+    .malloc_func  = std_malloc,
+    .realloc_func = std_realloc,
+    .free_func    = std_free,
+};
+
+static el_allocator_t allocator = {
+    .malloc_func  = std_malloc,
+    .realloc_func = std_realloc,
+    .free_func    = std_free,
+};
+
+/*
+**  Set the allocator of all memory the library allocates, also what it
+**  hands to the caller, e.g. lines from readline(), to be released with
+**  el_free().  NULL restores malloc().  Call before any other function.
+*/
+int el_set_allocator(const el_allocator_t *a)
+{
+    if (!a)
+        a = &std_allocator;
+
+    if (!a->malloc_func || !a->realloc_func || !a->free_func) {
+        errno = EINVAL;
+        return -1;
+    }
+    allocator = *a;
+
+    return 0;
+}
+
+void *el_malloc(size_t size)
+{
+    return allocator.malloc_func(allocator.arg, size);
+}
+
+void *el_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = el_malloc(nmemb * size);
+    if (ptr)
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+void *el_realloc(void *ptr, size_t size)
+{
+    return allocator.realloc_func(allocator.arg, ptr, size);
+}
+
+char *el_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *ptr;
+
+    ptr = el_malloc(len);
+    if (ptr)
+        memcpy(ptr, s, len);
+
+    return ptr;
+}
+
+void el_free(void *ptr)
+{
+    if (ptr)
+        allocator.free_func(allocator.arg, ptr);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "k&r"
+ *  c-basic-offset: 4
+ * End:
+ */
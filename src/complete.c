@@ -25,7 +25,7 @@
 
 #define MAX_TOTAL_MATCHES (256 << sizeof(char *))
 
-int rl_attempted_completion_over = 0;
+EL_TLS int rl_attempted_completion_over = 0;
 rl_completion_func_t *rl_attempted_completion_function = NULL;
 rl_compentry_func_t *rl_completion_entry_function = NULL;
 
@@ -70,12 +70,12 @@ static int FindMatches(const char *dir, const char *file, char ***avp)
         choices++;
         if ((total += strlen(p)) > MAX_TOTAL_MATCHES) {
             /* This is a bit too much. */
-            while (ac > 0) free(av[--ac]);
+            while (ac > 0) el_free(av[--ac]);
             continue;
         }
 
         if ((ac % MEM_INC) == 0) {
-	    word = malloc(sizeof(char *) * (ac + MEM_INC));
+	    word = el_malloc(sizeof(char *) * (ac + MEM_INC));
             if (!word) {
                 total = 0;
                 break;
@@ -83,14 +83,14 @@ static int FindMatches(const char *dir, const char *file, char ***avp)
 
             if (ac) {
                 memcpy(word, av, ac * sizeof(char *));
-                free(av);
+                el_free(av);
             }
             *avp = av = word;
         }
 
-        if ((av[ac] = strdup(p)) == NULL) {
+        if ((av[ac] = el_strdup(p)) == NULL) {
             if (ac == 0)
-                free(av);
+                el_free(av);
             total = 0;
             break;
         }
@@ -112,10 +112,10 @@ static int FindMatches(const char *dir, const char *file, char ***avp)
 	while (p > many + sizeof(many) - 8)
 	    *--p = ' ';
 
-        if ((p = strdup(p)) != NULL)
+        if ((p = el_strdup(p)) != NULL)
 	    av[ac++] = p;
 
-        if ((p = strdup("choices")) != NULL)
+        if ((p = el_strdup("choices")) != NULL)
 	    av[ac++] = p;
     } else {
         if (ac)
@@ -133,20 +133,20 @@ static int SplitPath(const char *path, char **dirpart, char **filepart)
     char        *fpart;
 
     if ((fpart = strrchr(path, '/')) == NULL) {
-        if ((dpart = strdup(DOT)) == NULL)
+        if ((dpart = el_strdup(DOT)) == NULL)
             return -1;
 
-        if ((fpart = strdup(path)) == NULL) {
-            free(dpart);
+        if ((fpart = el_strdup(path)) == NULL) {
+            el_free(dpart);
             return -1;
         }
     } else {
-        if ((dpart = strdup(path)) == NULL)
+        if ((dpart = el_strdup(path)) == NULL)
             return -1;
 
         dpart[fpart - path + 1] = '\0';
-        if ((fpart = strdup(fpart + 1)) == NULL) {
-            free(dpart);
+        if ((fpart = el_strdup(fpart + 1)) == NULL) {
+            el_free(dpart);
             return -1;
         }
     }
@@ -186,8 +186,8 @@ char *el_filename_complete(char *pathname, int *match)
         return NULL;
 
     if ((ac = FindMatches(dir, file, &av)) == 0) {
-        free(dir);
-        free(file);
+        el_free(dir);
+        el_free(file);
 
         return NULL;
     }
@@ -198,15 +198,15 @@ char *el_filename_complete(char *pathname, int *match)
         /* Exactly one match -- finish it off. */
         *match = 1;
         j = strlen(av[0]) - len + 1;
-        p = malloc(sizeof(char) * (j + 1));
+        p = el_malloc(sizeof(char) * (j + 1));
         if (p) {
             memcpy(p, av[0] + len, j);
             len = strlen(dir) + strlen(av[0]) + 2;
-            path = malloc(sizeof(char) * len);
+            path = el_malloc(sizeof(char) * len);
             if (path) {
                 snprintf(path, len, "%s/%s", dir, av[0]);
                 rl_add_slash(path, p);
-                free(path);
+                el_free(path);
             }
         }
     } else {
@@ -222,7 +222,7 @@ char *el_filename_complete(char *pathname, int *match)
 	breakout:
             if (i > len) {
                 j = i - len + 1;
-		p = malloc(sizeof(char) * j);
+		p = el_malloc(sizeof(char) * j);
                 if (p) {
                     memcpy(p, av[0] + len, j);
                     p[j - 1] = '\0';
@@ -232,61 +232,62 @@ char *el_filename_complete(char *pathname, int *match)
     }
 
     /* Clean up and return. */
-    free(dir);
-    free(file);
+    el_free(dir);
+    el_free(file);
     for (i = 0; i < ac; i++)
-        free(av[i]);
-    free(av);
+        el_free(av[i]);
+    el_free(av);
 
     return p;
 }
 
 char *rl_filename_completion_function(const char *text, int state)
 {
-    static char   **av, *dir, *file;
-    static size_t i, ac;
+    struct el_fncomp *fc = &el_cur->Fncomp;
 
     if (!state) {
-	if (SplitPath(text, &dir, &file) < 0)
+	if (SplitPath(text, &fc->dir, &fc->file) < 0)
 	    return NULL;
 
-	ac = FindMatches(dir, file, &av);
-	if (!ac) {
-	    free(dir);
-	    free(file);
+	fc->ac = FindMatches(fc->dir, fc->file, &fc->av);
+	if (!fc->ac) {
+	    el_free(fc->dir);
+	    el_free(fc->file);
+	    fc->dir = fc->file = NULL;
 	    return NULL;
 	}
 
-	i = 0;
+	fc->i = 0;
     }
 
-    if (i < ac) {
-	size_t len = (dir ? strlen(dir) : 0) + strlen(av[i]) + 3;
-	char *ptr = malloc(len);
+    if (fc->i < fc->ac) {
+	size_t len = (fc->dir ? strlen(fc->dir) : 0) + strlen(fc->av[fc->i]) + 3;
+	char *ptr = el_malloc(len);
 
 	if (ptr) {
-	    snprintf(ptr, len, "%s%s", dir, av[i++]);
-	    if (ac == 1)
+	    snprintf(ptr, len, "%s%s", fc->dir, fc->av[fc->i++]);
+	    if (fc->ac == 1)
 		rl_add_slash(ptr, ptr);
 
 	    return ptr;
 	}
     }
 
-    while (i > 0)
-	free(av[--i]);
+    while (fc->i > 0)
+	el_free(fc->av[--fc->i]);
+    fc->ac = 0;
 
-    if (av) {
-	free(av);
-	av = NULL;
+    if (fc->av) {
+	el_free(fc->av);
+	fc->av = NULL;
     }
-    if (dir) {
-	free(dir);
-	dir = NULL;
+    if (fc->dir) {
+	el_free(fc->dir);
+	fc->dir = NULL;
     }
-    if (file) {
-	free(file);
-	file = NULL;
+    if (fc->file) {
+	el_free(fc->file);
+	fc->file = NULL;
     }
 
     return NULL;
@@ -342,7 +343,7 @@ char **rl_completion_matches(const char *token, rl_compentry_func_t *generator)
     if (!generator)
 	return NULL;
 
-    array = malloc(512 * sizeof(char *));
+    array = el_malloc(512 * sizeof(char *));
     if (!array)
 	return NULL;
 
@@ -353,7 +354,7 @@ char **rl_completion_matches(const char *token, rl_compentry_func_t *generator)
     array[num] = NULL;
 
     if (!num) {
-	free(array);
+	el_free(array);
 	return NULL;
     }
 
@@ -386,25 +387,25 @@ static char *complete(char *token, int *match)
     if (words) {
 	int i = 0;
 
-	free(word);
+	el_free(word);
 	word = NULL;
 
         /* Exactly one match -- finish it off. */
 	if (words[0] && !words[1]) {
 	    *match = 1;
-	    word = strdup(words[0] + len);
+	    word = el_strdup(words[0] + len);
 	}
 
 	while (words[i])
-	    free(words[i++]);
-	free(words);
+	    el_free(words[i++]);
+	el_free(words);
 
 	if (word)
 	    return word;
     }
 
     if (word)
-	free(word);
+	el_free(word);
 
 fallback:
     return el_filename_complete(token, match);
@@ -452,8 +453,8 @@ int el_filename_list_possib(char *pathname, char ***av)
         return 0;
 
     ac = FindMatches(dir, file, av);
-    free(dir);
-    free(file);
+    el_free(dir);
+    el_free(file);
 
     return ac;
 }
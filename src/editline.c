@@ -21,20 +21,26 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
 
 #include "editline.h"
 
 /*
 **  Manifest constants.
 */
-#define SCREEN_COLS     80
-#define SCREEN_ROWS     24
 #define EL_STDIN        0
 #define EL_STDOUT       1
 #define NO_ARG          (-1)
+#define KEY_WAIT        (-2)    /* no key yet, see key_next() */
 #define DEL             127
+#define COL_BLOCK       64      /* bytes per column index entry */
+#define ARENA_CHUNK     1024
+#define ARENA_ALIGN     sizeof(void *)
 #define SEPS "\"#$&'()*:;<=>?[\\]^`{|}~\n\t "
 
 /*
@@ -44,23 +50,6 @@ typedef enum {
     TOupper, TOlower, TOcapitalize
 } el_case_t;
 
-/*
-**  Key to command mapping.
-*/
-typedef struct {
-    int         Key;
-    el_status_t (*Function)(void);
-} el_keymap_t;
-
-/*
-**  Command history structure.
-*/
-typedef struct {
-    int         Size;
-    int         Pos;
-    char      **Lines;
-} el_hist_t;
-
 /* User definable callbacks. */
 rl_getc_func_t *rl_getc_function = rl_getc;
 rl_hook_func_t *rl_event_hook;
@@ -70,83 +59,202 @@ rl_voidfunc_t  *rl_deprep_term_function = rl_deprep_terminal;
 /*
 **  Globals.
 */
-int               rl_eof;
-int               rl_erase;
-int               rl_intr;
-int               rl_kill;
-int               rl_quit;
+EL_TLS int        rl_eof;
+EL_TLS int        rl_erase;
+EL_TLS int        rl_intr;
+EL_TLS int        rl_kill;
+EL_TLS int        rl_quit;
 #ifdef CONFIG_SIGSTOP
-int               rl_susp;
+EL_TLS int        rl_susp;
 #endif
 
 int               el_hist_size = 15;
-static el_hist_t  H = {
-    .Size  = 0,
-    .Pos   = 0,
-    .Lines = NULL,
-};
 
 static char        NILSTR[] = "";
-static const char *el_input = NILSTR;
-static char       *Yanked;
-static char       *Screen;
 static char       NEWLINE[]= CRLF;
 static char       CLEAR[]= "\ec";
-static const char *el_term = "dumb";
-static int        Repeat;
-static int        old_point;
-/* Canonical key a cursor jump declares for reposition(): the Home/End keys
- * arrive as multi-byte escape sequences, so reposition() only sees the
- * leading ESC and cannot tell them from any other escape.  beg_line() and
- * end_line() set this so they are repositioned like Ctrl-A / Ctrl-E. */
-static int        repos_key;
-static int        el_push_back;
-static int        el_pushed;
-static int        el_intr_pending;
-static int        el_infd  = EL_STDIN;
-static int        el_outfd = EL_STDOUT;
-static el_keymap_t Map[];
-static el_keymap_t MetaMap[];
-static size_t     Length = 0;
-static size_t     ScreenCount;
-static size_t     ScreenSize;
-static char       *backspace = "\b";
-static char       *old_search = NULL;
-static int        tty_cols = SCREEN_COLS;
-static int        tty_rows = SCREEN_ROWS;
-static int        Searching = 0;
-static const char *(*search_move)(void);
-static const char *old_prompt = NULL;
-static rl_vcpfunc_t *line_handler = NULL;
-static char       *line_up = "\x1b[A";
-static char       *line_down = "\x1b[B";
-/* Used as a display-column proxy in the wrap math: exact only for a
- * printable single-width prompt.  A multibyte or escape-bearing prompt
- * needs a real width (see RL_PROMPT_START/END_IGNORE, issue #48). */
-static int        prompt_len = 0;
+
+/*
+**  The default session, used by the readline() API.  Its keymaps are
+**  the tables at the end of this file.
+*/
+static el_keymap_func_t *DefaultMap[256];
+static el_keymap_func_t *DefaultMetaMap[256];
+EL_TLS el_session_t el_default = {
+    .el_input  = NILSTR,
+    .el_term   = "dumb",
+    .el_infd   = EL_STDIN,
+    .el_outfd  = EL_STDOUT,
+    .input_fd  = -1,
+    .Map       = DefaultMap,
+    .MetaMap   = DefaultMetaMap,
+    .backspace = "\b",
+    .tty_cols  = SCREEN_COLS,
+    .tty_rows  = SCREEN_ROWS,
+    .msg_fd    = { -1, -1 },
+};
+#ifdef EL_THREAD_LOCAL
+EL_TLS el_session_t *el_cur_tls;
+
+/* Key sequences are shared like the keymaps: the trie of the default
+ * session, as last bound, is copied by sessions that start without one,
+ * e.g. the default session of a new thread.  See seq_init() */
+static el_seqnode_t *DefaultSeq;
+static size_t DefaultSeqLen;
+static size_t DefaultSeqSize;
+#else
+el_session_t *el_cur = &el_default;
+#endif
+
+/* State of the current session, see struct el_session */
+#define H               (el_cur->H)
+#define el_input        (el_cur->el_input)
+#define Yanked          (el_cur->Yanked)
+#define Arena           (el_cur->Arena)
+#define Screen          (el_cur->Screen)
+#define ScreenCount     (el_cur->ScreenCount)
+#define ScreenSize      (el_cur->ScreenSize)
+#define out_held        (el_cur->out_held)
+#define out_sock        (el_cur->out_sock)
+#define el_term         (el_cur->el_term)
+#define Repeat          (el_cur->Repeat)
+#define old_point       (el_cur->old_point)
+#define el_push_back    (el_cur->el_push_back)
+#define el_pushed       (el_cur->el_pushed)
+#define el_intr_pending (el_cur->el_intr_pending)
+#define el_infd         (el_cur->el_infd)
+#define el_outfd        (el_cur->el_outfd)
+#define Input           (el_cur->Input)
+#define input_fd        (el_cur->input_fd)
+#define input_len       (el_cur->input_len)
+#define input_pos       (el_cur->input_pos)
+#define input_eof       (el_cur->input_eof)
+#define feed            (el_cur->feed)
+#define feed_len        (el_cur->feed_len)
+#define feed_pos        (el_cur->feed_pos)
+#define Map             (el_cur->Map)
+#define MetaMap         (el_cur->MetaMap)
+#define Seq             (el_cur->Seq)
+#define SeqLen          (el_cur->SeqLen)
+#define SeqSize         (el_cur->SeqSize)
+#define Keyseq          (el_cur->Keyseq)
+#define Resume          (el_cur->Resume)
+#define Length          (el_cur->Length)
+#define backspace       (el_cur->backspace)
+#define old_search      (el_cur->old_search)
+#define tty_cols        (el_cur->tty_cols)
+#define tty_rows        (el_cur->tty_rows)
+#define Searching       (el_cur->Searching)
+#define search_move     (el_cur->search_move)
+#define old_prompt      (el_cur->old_prompt)
+#define rl_saved_prompt (el_cur->rl_saved_prompt)
+#define line_handler    (el_cur->line_handler)
+#define prompt_len      (el_cur->prompt_len)
+#define Shown           (el_cur->Shown)
+#define ShownSize       (el_cur->ShownSize)
+#define shown_end       (el_cur->shown_end)
+#define shown_cols      (el_cur->shown_cols)
+#define shown_meta      (el_cur->shown_meta)
+#define prompt_shown    (el_cur->prompt_shown)
+#define cursor_col      (el_cur->cursor_col)
+#define cursor_wrap     (el_cur->cursor_wrap)
+#define shown_stale     (el_cur->shown_stale)
+#define ColIndex        (el_cur->ColIndex)
+#define ColIndexSize    (el_cur->ColIndexSize)
+#define col_valid       (el_cur->col_valid)
+#define tty_can_edit    (el_cur->tty_can_edit)
+#define tc_area         (el_cur->tc_area)
+#define tc_ich          (el_cur->tc_ich)
+#define tc_dch          (el_cur->tc_dch)
+#define tc_el           (el_cur->tc_el)
+#define tc_ed           (el_cur->tc_ed)
+#define paste_mode      (el_cur->paste_mode)
+#define Paste           (el_cur->Paste)
+#define PasteLen        (el_cur->PasteLen)
+#define PasteSize       (el_cur->PasteSize)
+#define Msgs            (el_cur->Msgs)
+#define msg_fd          (el_cur->msg_fd)
 
 int               el_no_echo = 0; /* e.g., under Emacs */
 int               el_no_hist = 0;
-int               rl_point;
-int               rl_mark;
-int               rl_end;
-int               rl_meta_chars = 0; /* Display 8-bit chars as the actual char(0) or as `M-x'(1)? */
+int               el_no_bracketed_paste = 0;
+int               el_esc_timeout = 500;
+int               el_callback_drain = 0;
+EL_TLS int        rl_point;
+EL_TLS int        rl_mark;
+EL_TLS int        rl_end;
+EL_TLS int        rl_meta_chars = 0; /* Display 8-bit chars as the actual char(0) or as `M-x'(1)? */
 int               rl_inhibit_complete = 0;
-char             *rl_line_buffer = NULL;
-static const char *rl_saved_prompt = NULL;
-const char       *rl_prompt = NULL;
+EL_TLS char      *rl_line_buffer = NULL;
+EL_TLS const char *rl_prompt = NULL;
 const char       *rl_readline_name = NULL; /* Set by calling program, for conditional parsing of ~/.inputrc - Not supported yet! */
-FILE             *rl_instream = NULL;  /* The stdio stream from which input is read. Defaults to stdin if NULL */
-FILE             *rl_outstream = NULL; /* The stdio stream to which output is flushed. Defaults to stdout if NULL */
+EL_TLS FILE      *rl_instream = NULL;  /* The stdio stream from which input is read. Defaults to stdin if NULL */
+EL_TLS FILE      *rl_outstream = NULL; /* The stdio stream to which output is flushed. Defaults to stdout if NULL */
 
 /* Declarations. */
 static char     *editinput(int complete);
+static void      msg_show(void);
 #ifdef CONFIG_USE_TERMCAP
 extern char     *tgetstr(const char *, char **);
 extern int      tgetent(char *, const char *);
 extern int      tgetnum(const char *);
+extern char     *tgoto(const char *, int, int);
+extern int      tputs(const char *, int, int (*)(int));
 #endif
 
+/*
+**  Scratch memory for the commands of a line, e.g. the word to complete,
+**  bump-allocated and released all at once when the line is done.
+*/
+static void *arena_alloc(size_t size)
+{
+    el_chunk_t *c = Arena;
+    size_t len;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (!c || c->size - c->used < size) {
+        len = MAX(size, ARENA_CHUNK);
+        c = el_malloc(sizeof(el_chunk_t) + len);
+        if (!c)
+            return NULL;
+
+        c->size = len;
+        c->used = 0;
+        c->next = Arena;
+        Arena = c;
+    }
+    c->used += size;
+
+    return &c->data[c->used - size];
+}
+
+static char *arena_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *p;
+
+    p = arena_alloc(len);
+    if (p)
+        memcpy(p, str, len);
+
+    return p;
+}
+
+/* Release it all, keep a first chunk of the usual size for next line */
+static void arena_reset(int keep)
+{
+    el_chunk_t *c;
+
+    while ((c = Arena)) {
+        if (keep && !c->next && c->size == ARENA_CHUNK) {
+            c->used = 0;
+            break;
+        }
+        Arena = c->next;
+        el_free(c);
+    }
+}
+
 /*
 **  Misc. local helper functions.
 */
@@ -170,6 +278,39 @@ static int utf8_is_cont(unsigned char c)
     return (c & 0xC0) == 0x80;
 }
 
+/* Length of the UTF-8 sequence lead byte c starts, 1 if c is not a valid
+ * lead byte, e.g. ASCII, a continuation byte, or an overlong C0/C1. */
+static int utf8_len(unsigned char c)
+{
+    if (c >= 0xC2 && c <= 0xDF)
+        return 2;
+    if (c >= 0xE0 && c <= 0xEF)
+        return 3;
+    if (c >= 0xF0 && c <= 0xF4)
+        return 4;
+
+    return 1;
+}
+
+/* True if byte c is valid as byte n of a sequence led by 'lead', which
+ * rules out overlong forms, surrogates and code points past U+10FFFF. */
+static int utf8_cont_ok(unsigned char lead, int n, unsigned char c)
+{
+    if (!utf8_is_cont(c))
+        return 0;
+    if (n > 1)
+        return 1;
+
+    switch (lead) {
+    case 0xE0: return c >= 0xA0;
+    case 0xED: return c <= 0x9F;
+    case 0xF0: return c >= 0x90;
+    case 0xF4: return c <= 0x8F;
+    }
+
+    return 1;
+}
+
 /* Number of glyph starts in rl_line_buffer[begin .. begin + count), i.e. the
  * character count of a byte range.  Equals count for plain ASCII. */
 static int glyph_count(int begin, int count)
@@ -197,42 +338,115 @@ static int next_glyph(int pos)
     return pos;
 }
 
-/* Display columns occupied by rl_line_buffer[0 .. b): one column per glyph,
- * like the wrap math's byte==column assumption but corrected for multibyte
- * (continuation bytes add no column).  Equals b for plain ASCII. */
-static int disp_col(int b)
+/* True while the glyph before rl_point still waits for UTF-8 continuation
+ * bytes, i.e. a multibyte character is being typed one byte at a time. */
+static int glyph_pending(void)
 {
-    return glyph_count(0, b);
+    int g = rl_point, need;
+
+    while (g > 0 && rl_point - g < 4 && utf8_is_cont(rl_line_buffer[g - 1]))
+        g--;
+    if (g == 0)
+        return 0;
+
+    g--;
+    switch ((unsigned char)rl_line_buffer[g] & 0xF0) {
+    case 0xC0:
+    case 0xD0: need = 2; break;
+    case 0xE0: need = 3; break;
+    case 0xF0: need = 4; break;
+    default:   return 0;
+    }
+
+    return rl_point - g < need && !utf8_is_cont(rl_line_buffer[rl_point]);
 }
 
-/* Inverse of disp_col(): byte offset of the glyph boundary at display
- * column col.  Clamped to [0, rl_end]. */
-static int disp_col_to_byte(int col)
+/* Display columns tty_show() uses for byte c: two for ^X and ^?, three
+ * for M-x, none for a UTF-8 continuation byte and one for the rest. */
+static int glyph_width(unsigned char c)
 {
-    int b = 0;
+    if (rl_meta_chars && ISMETA(c))
+        return 3;
+    if (utf8_is_cont(c))
+        return 0;
+    if (c == DEL || ISCTL(c))
+        return 2;
 
-    while (b < rl_end && col-- > 0)
-        b = next_glyph(b);
+    return 1;
+}
 
-    return b;
+/* Display columns occupied by line[from .. to).  Equals to - from for
+ * printable ASCII. */
+static int glyph_cols(const char *line, int from, int to)
+{
+    int col = 0;
+
+    while (from < to)
+        col += glyph_width(line[from++]);
+
+    return col;
 }
 
 /*
 **  TTY input/output functions.
 */
 
+/* A client gone from a socket must not kill a server with SIGPIPE.  A
+ * pipe still raises it, an application writing to one ignores it. */
+static ssize_t tty_write(const char *buf, size_t len)
+{
+#ifdef MSG_NOSIGNAL
+    if (out_sock)
+        return send(el_outfd, buf, len, MSG_NOSIGNAL);
+#endif
+    return write(el_outfd, buf, len);
+}
+
+/* Write out all of Screen, also across short writes and, should the
+ * application have made el_outfd non-blocking, EAGAIN.  In callback mode
+ * what the terminal does not take is kept for rl_output_pending(). */
 static void tty_flush(void)
 {
+    struct pollfd pfd;
+    size_t done = 0;
     ssize_t res;
 
-    if (!ScreenCount)
+    if (!ScreenCount || el_no_echo || out_held)
         return;
 
-    if (!el_no_echo) {
-        res = write(el_outfd, Screen, ScreenCount);
-        if (res > 0)
-            ScreenCount = 0;
+    while (done < ScreenCount) {
+        res = tty_write(Screen + done, ScreenCount - done);
+        if (res > 0) {
+            done += res;
+            continue;
+        }
+        if (res == -1 && errno == EINTR)
+            continue;
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (line_handler) {
+                memmove(Screen, Screen + done, ScreenCount - done);
+                ScreenCount -= done;
+                return;
+            }
+
+            pfd.fd = el_outfd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+                continue;
+        }
+        break;                  /* e.g. hangup, the rest is lost */
     }
+
+    ScreenCount = 0;
+}
+
+/* Write what el_outfd takes of queued output, returns what is left: wait
+ * for POLLOUT on el_outfd while non-zero and call again. */
+size_t rl_output_pending(void)
+{
+    tty_flush();
+
+    return ScreenCount;
 }
 
 static void tty_put(const char c)
@@ -240,15 +454,18 @@ static void tty_put(const char c)
     if (el_no_echo)
         return;
 
-    Screen[ScreenCount] = c;
-    if (++ScreenCount >= ScreenSize) {
-	char *ptr;
+    if (ScreenCount >= ScreenSize) {
+        size_t size = ScreenSize ? ScreenSize * 2 : SCREEN_INC;
+        char *ptr;
 
-        ScreenSize += SCREEN_INC;
-        ptr = realloc(Screen, sizeof(char) * ScreenSize);
-	if (ptr)
-	    Screen = ptr;
+        ptr = el_realloc(Screen, sizeof(char) * size);
+        if (!ptr)
+            return;
+        Screen = ptr;
+        ScreenSize = size;
     }
+
+    Screen[ScreenCount++] = c;
 }
 
 static void tty_puts(const char *p)
@@ -274,50 +491,100 @@ static void tty_show(unsigned char c)
     }
 }
 
-static void tty_string(const char *p)
+static void tty_push(int c)
 {
-    int i = disp_col(rl_point) + prompt_len + 1;
+    el_pushed = 1;
+    el_push_back = c;
+}
 
-    while (*p) {
-        unsigned char c = *p++;
+/* Wait for el_infd to become readable, showing messages as they are
+ * posted meanwhile, once el_session_message_fd() has enabled that. */
+static void input_wait(void)
+{
+    struct pollfd pfd[2];
 
-        tty_show(c);
-        if (utf8_is_cont(c))
-            continue;                  /* continuation byte: zero columns */
-        /* The margin glitch forces the terminal's deferred wrap.  A glyph
-         * is echoed one keystroke at a time, so firing it after a multibyte
-         * start byte would split the glyph; let the terminal handle the
-         * wrap natively for those and only glitch on ASCII. */
-        if (i % tty_cols == 0 && c < 0x80) {
-            tty_put(' ');
-            tty_put('\b');
+    if (msg_fd[0] < 0)
+        return;
+
+    pfd[0].fd = el_infd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = msg_fd[0];
+    pfd[1].events = POLLIN;
+    do {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno != EINTR)
+                return;
+            continue;
         }
-        i++;
-    }
+        if (pfd[1].revents) {
+            msg_show();
+            tty_flush();
+        }
+    } while (!pfd[0].revents);
 }
 
-static void tty_push(int c)
+/* Refill the input buffer from el_infd, with as much as one read() gets
+ * if it has been used up.  Returns the number of buffered bytes.  Only
+ * readline() waits for input, in callback mode a non-blocking el_infd
+ * with nothing to read returns 0 with errno EAGAIN: no key yet. */
+static int input_fill(void)
 {
-    el_pushed = 1;
-    el_push_back = c;
+    struct pollfd pfd;
+    int r;
+
+    if (input_pos < input_len && input_fd == el_infd)
+        return input_len - input_pos;
+
+    do {
+        if (!line_handler)
+            input_wait();
+        r = read(el_infd, Input, sizeof(Input));
+        if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (line_handler)
+                break;
+
+            /* Non-blocking el_infd, no data yet is not EOF */
+            pfd.fd = el_infd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                break;
+            errno = EINTR;
+        }
+    } while (r == -1 && errno == EINTR);
+
+    input_pos = input_len = 0;
+    if (r <= 0) {
+        if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            input_eof = 1;
+        return 0;
+    }
+    input_fd = el_infd;
+    input_len = r;
+
+    return r;
 }
 
+/* Serve input from the buffer, one key at a time. */
 int rl_getc(void)
 {
-    int r;
-    char c;
+    if (!input_fill())
+        return EOF;
 
-    do {
-        r = read(el_infd, &c, 1);
-    } while (r == -1 && errno == EINTR);
+    return Input[input_pos++];
+}
+
+/* True if input is queued in memory: pushed back, from a macro, or read
+ * ahead into the input buffer. */
+static int tty_buffered(void)
+{
+    if (el_pushed || *el_input || feed_pos < feed_len)
+        return 1;
 
-    return r == 1 ? c : EOF;
+    return rl_getc_function == rl_getc && input_pos < input_len && input_fd == el_infd;
 }
 
 static int tty_get(void)
 {
-    tty_flush();
-
     if (el_pushed) {
         el_pushed = 0;
         return el_push_back;
@@ -326,9 +593,59 @@ static int tty_get(void)
     if (*el_input)
         return *el_input++;
 
+    if (feed_pos < feed_len)
+        return (char)feed[feed_pos++];
+    if (feed)
+        return EOF;             /* el_infd is the application's */
+
+    /* Flush only when the read may block, not for keys already in memory */
+    if (!tty_buffered())
+        tty_flush();
+
     return rl_getc_function();
 }
 
+/* True if more input is queued: in memory or, when we read el_infd
+ * ourselves, already waiting there. */
+static int tty_pending(void)
+{
+    struct pollfd pfd;
+
+    if (tty_buffered())
+        return 1;
+    if (feed || rl_getc_function != rl_getc)
+        return 0;
+
+    pfd.fd = el_infd;
+    pfd.events = POLLIN;
+
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* Wait up to ms milliseconds, or forever if negative, for more input.
+ * A custom rl_getc_function cannot be polled, so it is left to block. */
+static int tty_wait(int ms)
+{
+    struct pollfd pfd;
+    int rc;
+
+    if (tty_buffered())
+        return 1;
+    if (feed)
+        return 0;
+    if (rl_getc_function != rl_getc)
+        return 1;
+
+    tty_flush();
+    pfd.fd = el_infd;
+    pfd.events = POLLIN;
+    do {
+        rc = poll(&pfd, 1, ms);
+    } while (rc == -1 && errno == EINTR);
+
+    return rc != 0;
+}
+
 #define tty_back()  tty_puts(backspace)
 
 static void tty_backn(int n)
@@ -337,19 +654,574 @@ static void tty_backn(int n)
         tty_back();
 }
 
-static void tty_forwardn(int n)
+/* Control sequence CSI n cmd, e.g. a cursor motion.  A count of one is
+ * the default and left out. */
+static void tty_csi(int n, int cmd)
 {
-    char buf[12];
+    char buf[16];
 
-    snprintf(buf, sizeof(buf), "\x1b[%dC", n);
+    if (n == 1)
+        snprintf(buf, sizeof(buf), "\x1b[%c", cmd);
+    else
+        snprintf(buf, sizeof(buf), "\x1b[%d%c", n, cmd);
     tty_puts(buf);
 }
 
+#ifdef CONFIG_USE_TERMCAP
+static int tty_putc(int c)
+{
+    tty_put(c);
+    return c;
+}
+#endif
+
+/* Insert (@) or delete (P) n characters, or erase to the end of the line
+ * (K) or screen (J), with the string termcap has for it, if any. */
+static void tty_edit(int n, int cmd)
+{
+#ifdef CONFIG_USE_TERMCAP
+    char *cap;
+
+    switch (cmd) {
+    case '@': cap = tc_ich; break;
+    case 'P': cap = tc_dch; break;
+    case 'K': cap = tc_el;  break;
+    default:  cap = tc_ed;  break;
+    }
+    if (cap) {
+        tputs(cmd == '@' || cmd == 'P' ? tgoto(cap, 0, n) : cap, 1, tty_putc);
+        return;
+    }
+#endif
+    tty_csi(n, cmd);
+}
+
+/* Bytes tty_csi() writes for count n. */
+static int csi_len(int n)
+{
+    int len = 3;
+
+    if (n == 1)
+        return len;
+    for (; n > 0; n /= 10)
+        len++;
+
+    return len;
+}
+
 static void tty_info(void)
 {
     rl_reset_terminal(NULL);
 }
 
+/*
+**  Damage-tracking renderer.  Editing commands only change the line
+**  buffer and rl_point; reposition() then compares the line with the
+**  screen model and emits the minimal update: the glyphs that differ,
+**  blanks for what the line no longer covers, and a cursor move.
+*/
+
+/* Forget the screen: the cursor sits at the start of an empty row. */
+static void frame_reset(void)
+{
+    shown_end = shown_cols = 0;
+    prompt_shown = 0;
+    cursor_col = cursor_wrap = 0;
+}
+
+/* Print screen columns [from, to) of a frame showing line[0 .. end)
+ * after the prompt, or, unless emit is set, only count the bytes that
+ * would take.  The glyph at byte i starts on column c, at or before from
+ * unless that is in the prompt. */
+static int put_cells(const char *line, int end, int i, int c, int from, int to, int emit)
+{
+    int len = 0, col, j, k, n, w;
+
+    for (col = from; col < to && col < prompt_len; col++, len++) {
+        if (emit)
+            tty_put(rl_prompt[col]);
+    }
+
+    for (; i < end && c < to; i += n, c += w) {
+        unsigned char ch = line[i];
+
+        w = glyph_width(ch);
+        for (n = 1; w == 1 && i + n < end && utf8_is_cont(line[i + n]); n++)
+            ;
+
+        for (k = from > c ? from - c : 0; k < w && c + k < to; k++) {
+            if (w == 1) {
+                len += n;
+                for (j = 0; emit && j < n; j++)
+                    tty_put(line[i + j]);
+                continue;
+            }
+
+            len++;
+            if (!emit)
+                continue;
+            if (ch == DEL)
+                tty_put(k ? '?' : '^');
+            else if (ISCTL(ch))
+                tty_put(k ? UNCTL(ch) : '^');
+            else
+                tty_put(k == 0 ? 'M' : k == 1 ? '-' : UNMETA(ch));
+        }
+    }
+
+    return len;
+}
+
+/* Bring ColIndex up to date for its entries 0 .. n. */
+static int col_index(size_t n)
+{
+    size_t k;
+    int col;
+
+    if (ColIndexSize <= n) {
+        size_t size = MAX(n + 1, ColIndexSize * 2);
+        int *p = el_realloc(ColIndex, sizeof(int) * size);
+
+        if (!p)
+            return -1;
+        ColIndex = p;
+        ColIndexSize = size;
+    }
+
+    if (!col_valid) {
+        ColIndex[0] = 0;
+        col_valid = 1;
+    }
+    for (; col_valid <= n; col_valid++) {
+        k = (col_valid - 1) * COL_BLOCK;
+        col = ColIndex[col_valid - 1];
+        ColIndex[col_valid] = col + glyph_cols(Shown, k, k + COL_BLOCK);
+    }
+
+    return 0;
+}
+
+/* Display columns of Shown[0 .. b), b <= shown_end. */
+static int shown_col(int b)
+{
+    int n = b / COL_BLOCK;
+
+    if (col_index(n))
+        return glyph_cols(Shown, 0, b);
+
+    return ColIndex[n] + glyph_cols(Shown, n * COL_BLOCK, b);
+}
+
+/* Byte offset of the glyph in Shown on column col, counted from the end
+ * of the prompt, and the column at, where that glyph starts. */
+static int shown_glyph(int col, int *at)
+{
+    int lo = 0, hi, mid, b, c = 0, w;
+
+    /* Extend the index past col, or up to the end of Shown, and look up
+     * the last entry at or before col. */
+    hi = col_valid ? (int)col_valid - 1 : 0;
+    if (!col_index(hi)) {
+        while (ColIndex[hi] <= col && (hi + 1) * COL_BLOCK <= shown_end && !col_index(hi + 1))
+            hi++;
+        while (lo < hi) {
+            mid = (lo + hi + 1) / 2;
+            if (ColIndex[mid] <= col)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        c = ColIndex[lo];
+    }
+
+    for (b = lo * COL_BLOCK; b < shown_end; b++, c += w) {
+        w = glyph_width(Shown[b]);
+        if (w && col < c + w)
+            break;
+    }
+
+    *at = c;
+    return b;
+}
+
+/* Reprint screen columns [from, to) from the model. */
+static int reprint(int from, int to, int emit)
+{
+    int b = 0, at = 0;
+
+    if (from > prompt_len)
+        b = shown_glyph(from - prompt_len, &at);
+
+    return put_cells(Shown, shown_end, b, prompt_len + at, from, to, emit);
+}
+
+/* Move the terminal cursor to screen column col of the frame by the
+ * cheapest way in bytes: backspaces, CSI n D or C, a carriage return
+ * and a move right, CSI n G, or reprinting the cells in between.  Rows
+ * change by CSI n A or B; CUP is of no use since the screen row of the
+ * frame is unknown. */
+static void move_to(int col)
+{
+    enum { STAY, BACKSPACE, CUB, CUF, CHA, REPRINT, CR_CUF, CR_REPRINT } how;
+    int row, x, tx, dx, dy, best, cost;
+
+    if (col == cursor_col)
+        return;
+
+    /* The start of the row after the frame holds nothing and may not
+     * exist yet: land there the way drawing does, by (re)printing the
+     * column before it and leaving the wrap to the terminal. */
+    if (col > 0 && col % tty_cols == 0 && col >= shown_cols) {
+        move_to(col - 1);
+        reprint(col - 1, col, 1);
+        cursor_col = col;
+        cursor_wrap = 1;
+        return;
+    }
+
+    /* A deferred wrap leaves the cursor in the last column of the row
+     * above, where terminals disagree on relative moves: only the
+     * absolute ones, CR and CHA, are safe to use from there. */
+    row = cursor_col / tty_cols;
+    x = cursor_col % tty_cols;
+    if (cursor_wrap) {
+        row--;
+        x = tty_cols - 1;
+    }
+
+    dy = col / tty_cols - row;
+    if (dy < 0)
+        tty_csi(-dy, 'A');
+    else if (dy > 0)
+        tty_csi(dy, 'B');
+
+    tx = col % tty_cols;
+    dx = tx - x;
+    x = col - tx + x;                   /* frame column below the cursor */
+
+    how = CHA;
+    best = csi_len(tx + 1);
+    cost = 1 + (tx ? csi_len(tx) : 0);
+    if (cost < best) {
+        how = CR_CUF;
+        best = cost;
+    }
+    if (!shown_stale && tx + 1 < best) {
+        cost = 1 + reprint(col - tx, col, 0);
+        if (cost < best) {
+            how = CR_REPRINT;
+            best = cost;
+        }
+    }
+
+    if (!cursor_wrap) {
+        if (dx == 0) {
+            how = STAY;
+        } else if (dx < 0) {
+            cost = -dx * strlen(backspace);
+            if (cost < best) {
+                how = BACKSPACE;
+                best = cost;
+            }
+            if (csi_len(-dx) < best)
+                how = CUB;
+        } else {
+            if (csi_len(dx) < best) {
+                how = CUF;
+                best = csi_len(dx);
+            }
+            if (!shown_stale && dx < best && reprint(x, col, 0) < best)
+                how = REPRINT;
+        }
+    }
+
+    switch (how) {
+    case STAY:       break;
+    case BACKSPACE:  tty_backn(-dx);             break;
+    case CUB:        tty_csi(-dx, 'D');          break;
+    case CUF:        tty_csi(dx, 'C');           break;
+    case CHA:        tty_csi(tx + 1, 'G');       break;
+    case REPRINT:    reprint(x, col, 1);         break;
+    case CR_CUF:
+        tty_put('\r');
+        if (tx)
+            tty_csi(tx, 'C');
+        break;
+    case CR_REPRINT:
+        tty_put('\r');
+        reprint(col - tx, col, 1);
+        break;
+    }
+
+    cursor_col = col;
+    cursor_wrap = 0;
+}
+
+/* Draw rl_line_buffer[from .. to) at the cursor, which must sit on the
+ * screen column of from. */
+static void draw(int from, int to)
+{
+    int i;
+
+    for (i = from; i < to; i++) {
+        tty_show(rl_line_buffer[i]);
+        cursor_col += glyph_width(rl_line_buffer[i]);
+    }
+
+    if (to > from)
+        cursor_wrap = cursor_col % tty_cols == 0;
+}
+
+/* Like move_to(), but with a deferred wrap resolved, so the cursor is
+ * on col also at the start of a row, as ICH, DCH and EL need. */
+static void move_onto(int col)
+{
+    move_to(col);
+    if (cursor_wrap) {
+        tty_put('\r');
+        tty_csi(1, 'B');
+        cursor_wrap = 0;
+    }
+}
+
+/* Where the line differs from the screen model: bytes [i, j) of the
+ * line replace bytes [i, k) of Shown, on screen columns [ci, cj) and
+ * [ci, ck) respectively.  What follows is the same in both. */
+struct damage {
+    int i, j, k;
+    int ci, cj, ck;
+};
+
+/* Byte offset of the glyph of the line on screen column col, and the
+ * column at, where it starts. */
+static int line_glyph(const struct damage *dm, int col, int *at)
+{
+    int b, c, w;
+
+    if (col < dm->ci) {
+        b = shown_glyph(col - prompt_len, at);
+        *at += prompt_len;
+        return b;
+    }
+
+    if (col >= dm->cj) {
+        b = shown_glyph(col - dm->cj + dm->ck - prompt_len, at);
+        *at += prompt_len + dm->cj - dm->ck;
+        return b + dm->j - dm->k;
+    }
+
+    for (b = dm->i, c = dm->ci; b < dm->j; b++, c += w) {
+        w = glyph_width(rl_line_buffer[b]);
+        if (w && col < c + w)
+            break;
+    }
+
+    *at = c;
+    return b;
+}
+
+/* Draw screen columns [from, to) of the line at column from. */
+static void fill(const struct damage *dm, int from, int to)
+{
+    int b, at;
+
+    if (from >= to)
+        return;
+
+    move_to(from);
+    b = line_glyph(dm, from, &at);
+    put_cells(rl_line_buffer, rl_end, b, at, from, to, 1);
+    cursor_col = to;
+    cursor_wrap = to % tty_cols == 0;
+}
+
+/* Blank the screen from the cursor up to column col, which is the end of
+ * the frame: with EL, or ED when the frame spans more rows, if that is
+ * shorter than spaces. */
+static void ceol(int col)
+{
+    int row;
+
+    if (cursor_col >= col)
+        return;
+
+    if (tty_can_edit && col - cursor_col > 3 + (cursor_wrap ? 4 : 0)) {
+        move_onto(cursor_col);
+        row = cursor_col / tty_cols;
+        tty_edit(1, (col - 1) / tty_cols > row ? 'J' : 'K');
+        return;
+    }
+
+    while (cursor_col < col) {
+        tty_put(' ');
+        cursor_col++;
+    }
+    cursor_wrap = cursor_col % tty_cols == 0;
+}
+
+/* Redraw a line whose damage lies on a single row by shifting the rest
+ * of the screen in place: per row, insert (ICH) or delete (DCH) characters
+ * where the unchanged tail starts and draw only the cells that move
+ * across rows. */
+static void shift_tail(const struct damage *dm, int cols)
+{
+    int c = dm->ci, d = dm->cj - dm->ck, c0, c1, q, p;
+
+    shown_stale = 1;
+    for (c0 = c - c % tty_cols; c0 < cols || c0 < shown_cols; c0 += tty_cols) {
+        c1 = c0 + tty_cols;
+        q = MAX(c0, dm->ck);                    /* old tail in this row */
+        p = MAX(c0, c);
+
+        if (d > 0) {
+            /* No use shifting the last row if the line grows past it. */
+            if (q < c1 - d && q < shown_cols && (cols <= c1 || shown_cols > c1)) {
+                fill(dm, p, q);
+                move_onto(q);
+                tty_edit(d, '@');
+                fill(dm, q, MIN(q + d, cols));
+            } else {
+                fill(dm, p, MIN(c1, cols));
+            }
+        } else if (q < shown_cols) {
+            q = MAX(c0, q + d);
+            fill(dm, p, q);
+            move_onto(q);
+            tty_edit(-d, 'P');
+            fill(dm, MAX(q, c1 + d), MIN(c1, cols));
+        }
+    }
+    shown_stale = 0;
+}
+
+/* Redraw the line from the damage on, blanking what it no longer covers. */
+static void redraw_tail(const struct damage *dm, int cols)
+{
+    move_to(dm->ci);
+    draw(dm->i, rl_end);
+    if (cols < shown_cols) {
+        move_to(cols);
+        ceol(shown_cols);
+    }
+}
+
+/* Bring the screen in line with the prompt, rl_line_buffer and rl_point. */
+static void reposition(void)
+{
+    struct damage dm;
+    int cols, point;
+
+    if (!rl_line_buffer)
+        return;
+
+    if (rl_point > rl_end)
+        rl_point = rl_end;
+    if (rl_point < 0)
+        rl_point = 0;
+
+    if (ShownSize < Length) {
+        char *p = el_realloc(Shown, sizeof(char) * Length);
+
+        if (!p)
+            return;
+        Shown = p;
+        ShownSize = Length;
+    }
+
+    dm.i = 0;
+    dm.j = rl_end;
+    dm.k = shown_end;
+
+    if (!prompt_shown) {
+        move_to(0);
+        tty_puts(rl_prompt);
+        cursor_col = prompt_len;
+        cursor_wrap = prompt_len > 0 && prompt_len % tty_cols == 0;
+        prompt_shown = 1;
+    } else if (shown_meta == rl_meta_chars) {
+        /* The damage starts at the first glyph that differs and ends at
+         * the last one, after which the line is the same as on screen,
+         * though maybe shifted. */
+        while (dm.i < rl_end && dm.i < shown_end && Shown[dm.i] == rl_line_buffer[dm.i])
+            dm.i++;
+        while (dm.i > 0 && dm.i < rl_end && utf8_is_cont(rl_line_buffer[dm.i]))
+            dm.i--;
+        while (dm.j > dm.i && dm.k > dm.i && Shown[dm.k - 1] == rl_line_buffer[dm.j - 1]) {
+            dm.j--;
+            dm.k--;
+        }
+        while (dm.j < rl_end && utf8_is_cont(rl_line_buffer[dm.j])) {
+            dm.j++;
+            dm.k++;
+        }
+    }
+
+    /* Columns come from the index of the model, but for the damage. */
+    dm.ci = prompt_len + (dm.i ? shown_col(dm.i) : 0);
+    dm.cj = dm.ci + glyph_cols(rl_line_buffer, dm.i, dm.j);
+    dm.ck = dm.k < shown_end ? prompt_len + shown_col(dm.k) : shown_cols;
+    cols = dm.cj + shown_cols - dm.ck;
+
+    if (rl_point <= dm.i)
+        point = prompt_len + (rl_point ? shown_col(rl_point) : 0);
+    else if (rl_point < dm.j)
+        point = dm.ci + glyph_cols(rl_line_buffer, dm.i, rl_point);
+    else if (rl_point == dm.j)
+        point = dm.cj;
+    else
+        point = dm.cj + prompt_len + shown_col(dm.k + rl_point - dm.j) - dm.ck;
+
+    if (cols == shown_cols) {
+        if (dm.i < dm.j) {
+            move_to(dm.ci);
+            draw(dm.i, dm.j);
+        }
+    } else if (tty_can_edit && dm.k < shown_end) {
+        int mark = ScreenCount, col = cursor_col, wrap = cursor_wrap;
+        size_t len;
+
+        /* Shifting the tail in place needs the damage on a single row, and
+         * may still lose to a plain redraw: try both, keep the shorter. */
+        if ((MAX(dm.cj, dm.ck) - 1) / tty_cols == dm.ci / tty_cols) {
+            shift_tail(&dm, cols);
+            len = ScreenCount - mark;
+            ScreenCount = mark;
+            cursor_col = col;
+            cursor_wrap = wrap;
+            redraw_tail(&dm, cols);
+            if (ScreenCount - mark > len) {
+                ScreenCount = mark;
+                cursor_col = col;
+                cursor_wrap = wrap;
+                shift_tail(&dm, cols);
+            }
+        } else {
+            redraw_tail(&dm, cols);
+        }
+    } else {
+        redraw_tail(&dm, cols);
+    }
+
+    memcpy(&Shown[dm.i], &rl_line_buffer[dm.i], rl_end - dm.i);
+    shown_end = rl_end;
+    shown_cols = cols;
+    shown_meta = rl_meta_chars;
+    if (col_valid > (size_t)dm.i / COL_BLOCK + 1)
+        col_valid = dm.i / COL_BLOCK + 1;
+
+    move_to(point);
+}
+
+/* Leave the cursor after the end of the line, e.g. before a newline. */
+static void reposition_end(void)
+{
+    int point = rl_point;
+
+    rl_point = rl_end;
+    reposition();
+    rl_point = point;
+}
+
 /*
 **  Glue routines to rl_ttyset()
 */
@@ -390,152 +1262,37 @@ void el_print_columns(int ac, char **av)
         colwidth = tty_cols;
     cols = tty_cols / colwidth;
 
+    reposition_end();
     tty_puts(NEWLINE);
     for (skip = ac / cols + 1, i = 0; i < skip; i++) {
         for (j = i; j < ac; j += skip) {
             for (p = av[j], len = strlen((char *)p), k = len; --k >= 0; p++)
                 tty_put(*p);
 
-            if (j + skip < ac) {
-                while (++len < colwidth)
-                    tty_put(' ');
-            }
-        }
-
-        tty_puts(NEWLINE);
-    }
-}
-
-static void reposition(int key)
-{
-    int len_with_prompt = prompt_len + disp_col(rl_end);
-    int n =  len_with_prompt / tty_cols;                  /* determine the number of lines */
-    int i = 0;
-    int col;
-
-    /* A Home/End jump arrives as an escape sequence, so reposition() is
-     * passed the leading ESC; honor the canonical key it declared instead. */
-    if (repos_key) {
-        key = repos_key;
-        repos_key = 0;
-    }
-
-    tty_put('\r');
-
-    if (n > 0) {
-        int line;
-
-	/* determine num of current line */
-        if (key == CTL('A') || key == CTL('E') || key == rl_kill)
-            line = (prompt_len + disp_col(old_point)) / tty_cols;
-        else
-            line = len_with_prompt / tty_cols;
-
-	/* move to end of line(s) */
-        if (key == CTL('E')) {
-	    int k;
-	    /* Row holding the end of the line and that row's column count.  A
-	     * line ending exactly on a row boundary keeps the cursor in that
-	     * row's last column (deferred wrap), not at the start of the next
-	     * row -- otherwise Ctrl-E steps onto a fresh row below and the
-	     * terminal scrolls the whole line up. */
-	    int last_row  = (len_with_prompt - 1) / tty_cols;  /* = n, less one on an exact fit */
-	    int last_cols = len_with_prompt - last_row * tty_cols;
-
-            for (k = line; k < last_row; k++)
-                tty_puts(line_down);
-
-	    /* redraw only that last row, landing the cursor at its end */
-            i = disp_col_to_byte(disp_col(rl_point) - last_cols);
-        } else {
-	    int k;
-
-	    /* CTRL-A, CTRL-U, insert (end, middle), remove (end, middle) */
-            for (k = line; k > 0; k--)
-                tty_puts(line_up); /* redraw characters until changed data */
-
-            tty_puts(rl_prompt);
-        }
-    } else if (n == 0) {
-        tty_puts(rl_prompt);
-    }
-
-    col = disp_col(i) + prompt_len;
-    for (; i < rl_point; i++) {
-        tty_show(rl_line_buffer[i]);
-        /* Look ahead at the next byte, not this one: the wrap newline is
-         * emitted inline with the glyph's bytes, so it must wait until the
-         * whole glyph is written or it would split it.  (tty_string and
-         * ceol guard on the current byte because their boundary action is
-         * a glitch/erase, not a byte of the glyph -- do not unify these.) */
-        if (utf8_is_cont((unsigned char)rl_line_buffer[i + 1]))
-            continue;
-	/* Wrap to the next row only when more characters follow; after the
-	 * final one the cursor stays at the end of this row (deferred wrap),
-	 * so a line ending on a row boundary does not scroll. */
-        if ((++col) % tty_cols == 0 && i + 1 < rl_point)
-            tty_put('\n');
-    }
-}
-
-static void left(el_status_t Change)
-{
-    if (rl_point) {
-        unsigned char c = rl_line_buffer[rl_point - 1];
-
-        /* Continuation bytes are zero-width: emit no cursor movement. */
-        if (!utf8_is_cont(c)) {
-            if ((disp_col(rl_point) + prompt_len) % tty_cols == 0) {
-                tty_puts(line_up);
-                tty_forwardn(tty_cols);
-            } else {
-                tty_back();
-            }
-
-            if (ISMETA(c)) {
-                if (rl_meta_chars) {
-                    tty_back();
-                    tty_back();
-                }
-            } else if (ISCTL(c)) {
-                tty_back();
+            if (j + skip < ac) {
+                while (++len < colwidth)
+                    tty_put(' ');
             }
         }
-    }
-
-    if (Change == CSmove)
-        rl_point--;
-}
 
-static void right(el_status_t Change)
-{
-    unsigned char c = rl_line_buffer[rl_point];
-
-    /* A continuation byte is zero-width, so it never triggers a wrap. */
-    if (!utf8_is_cont(c) && (disp_col(rl_point) + prompt_len + 1) % tty_cols == 0)
-        tty_put('\n');
-    else
-        tty_show(c);
+        tty_puts(NEWLINE);
+    }
 
-    if (Change == CSmove)
-        rl_point++;
+    /* The prompt and line are redrawn below the list. */
+    frame_reset();
 }
 
 /* Step the cursor one whole glyph, skipping trailing UTF-8 continuation
- * bytes.  Layered on the byte-granular left()/right() so the per-byte
- * callers (word, case, transpose) keep working unchanged. */
+ * bytes.  Only rl_point moves; reposition() updates the screen. */
 static void glyph_right(void)
 {
-    int next = next_glyph(rl_point);
-
-    while (rl_point < next)
-        right(CSmove);
+    rl_point = next_glyph(rl_point);
 }
 
 static void glyph_left(void)
 {
     do {
-        left(CSmove);
+        rl_point--;
     } while (rl_point > 0 && utf8_is_cont(rl_line_buffer[rl_point]));
 }
 
@@ -564,8 +1321,8 @@ static el_status_t do_macro(int c)
     return CSstay;
 }
 
-/* Skip forward to start of next word. If @move is set we also move the cursor. */
-static el_status_t do_forward(el_status_t move)
+/* Skip forward to the end of the next word. */
+static el_status_t do_forward(void)
 {
     int         i;
     char        *p;
@@ -575,16 +1332,12 @@ static el_status_t do_forward(el_status_t move)
         p = &rl_line_buffer[rl_point];
 
         /* Skip leading whitespace, like FSF Readline */
-        for ( ; rl_point < rl_end && (p[0] == ' ' || !is_alpha_num(p[0])); rl_point++, p++) {
-            if (move == CSmove)
-                right(CSstay);
-        }
+        for ( ; rl_point < rl_end && (p[0] == ' ' || !is_alpha_num(p[0])); rl_point++, p++)
+            continue;
 
         /* Skip to end of word, if inside a word. */
-        for (; rl_point < rl_end && is_alpha_num(p[0]); rl_point++, p++) {
-            if (move == CSmove)
-                right(CSstay);
-        }
+        for (; rl_point < rl_end && is_alpha_num(p[0]); rl_point++, p++)
+            continue;
 
         if (rl_point == rl_end)
             break;
@@ -600,7 +1353,7 @@ static el_status_t do_case(el_case_t type)
     int         count;
     char        *p;
 
-    do_forward(CSstay);
+    do_forward();
     if (old_point != rl_point) {
         if ((count = rl_point - old_point) < 0)
             count = -count;
@@ -609,7 +1362,7 @@ static el_status_t do_case(el_case_t type)
         if ((end = rl_point + count) > rl_end)
             end = rl_end;
 
-        for (i = rl_point, p = &rl_line_buffer[i]; rl_point < end; p++) {
+        for (i = rl_point, p = &rl_line_buffer[i]; rl_point < end; rl_point++, p++) {
             /* Only fold ASCII; a multibyte glyph's bytes must be left as-is,
              * else a single-byte locale's toupper/tolower corrupts them. */
             if ((unsigned char)*p < 0x80) {
@@ -620,11 +1373,10 @@ static el_status_t do_case(el_case_t type)
                     *p = tolower((unsigned char)(*p));
                 }
             }
-            right(CSmove);
         }
     }
 
-    return CSstay;
+    return CSmove;
 }
 
 static el_status_t case_down_word(void)
@@ -642,66 +1394,8 @@ static el_status_t case_cap_word(void)
     return do_case(TOcapitalize);
 }
 
-static void ceol(void)
-{
-    int         extras = 0;
-    int         base, col, i;
-    char        *p;
-
-    while (rl_point < 0) {
-        tty_put(' ');
-        rl_point++;
-    }
-
-    base = disp_col(rl_point) + prompt_len;
-    col = base;
-    for (i = rl_point, p = &rl_line_buffer[i]; i <= rl_end; i++, p++) {
-        if (utf8_is_cont((unsigned char)*p))
-            continue;               /* continuation byte: no display column */
-        if ((++col) % tty_cols == 0) {
-            tty_put(' ');
-            tty_put('\n');
-        }
-        else
-            tty_put(' ');
-        if (ISMETA(*p)) {
-            if (rl_meta_chars) {
-                tty_put(' ');
-                tty_put(' ');
-                extras += 2;
-            }
-        } else if (ISCTL(*p)) {
-            tty_put(' ');
-            extras++;
-        }
-    }
-
-    for (col += extras; col > base; col--) {
-        if (col % tty_cols == 0) {
-            tty_puts(line_up);
-            tty_forwardn(tty_cols);
-        } else {
-            tty_back();
-        }
-    }
-}
-
 static void clear_line(void)
 {
-    int n = (disp_col(rl_point) + prompt_len) / tty_cols;
-    rl_point = -(int)strlen(rl_prompt);
-
-    if (n > 0) {
-        for(int k = 0; k < n; k++)
-            tty_puts(line_up);
-        tty_put('\r');
-    }
-    else {
-        tty_put('\r');
-    }
-
-    ceol();
-
     rl_point = 0;
     rl_end = 0;
     rl_line_buffer[0] = '\0';
@@ -716,13 +1410,13 @@ static el_status_t insert_string(const char *p)
 
     len = strlen(p);
     if (rl_end + len >= Length) {
-        line = malloc(sizeof(char) * (Length + len + MEM_INC));
+        line = el_malloc(sizeof(char) * (Length + len + MEM_INC));
         if (!line)
             return CSstay;
 
         if (Length) {
             memcpy(line, rl_line_buffer, Length);
-            free(rl_line_buffer);
+            el_free(rl_line_buffer);
         }
 
         rl_line_buffer = line;
@@ -735,10 +1429,9 @@ static el_status_t insert_string(const char *p)
     memcpy(&rl_line_buffer[rl_point], p, len);
     rl_end += len;
     rl_line_buffer[rl_end] = '\0';
-    tty_string(&rl_line_buffer[rl_point]);
     rl_point += len;
 
-    return rl_point == rl_end ? CSstay : CSmove;
+    return CSmove;
 }
 
 int rl_insert_text(const char *text)
@@ -746,7 +1439,7 @@ int rl_insert_text(const char *text)
     int mark = rl_point;
 
     insert_string(text);
-    ceol();
+    reposition();
 
     return rl_point - mark;
 }
@@ -758,13 +1451,66 @@ static el_status_t redisplay(int cls)
     else
         tty_puts("\r\e[K");
 
-    tty_puts(rl_prompt);
-    rl_point = 0;
-    tty_string(rl_line_buffer);
-    rl_point = rl_end;
+    frame_reset();
+    reposition();
+
     return CSmove;
 }
 
+/* Print the messages posted since last time above the line, the whole
+ * batch between one clear and one redraw of the line.  Left queued while
+ * echo is off, e.g. at a password prompt. */
+static void msg_show(void)
+{
+    el_msg_t *m, *next, *list = NULL;
+    char buf[64];
+    char *p;
+
+    if (el_no_echo)
+        return;
+
+    /* Drain the wakeups first, a message posted after the exchange below
+     * then finds the queue empty and wakes us again. */
+    if (msg_fd[0] >= 0) {
+        while (read(msg_fd[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    m = __atomic_exchange_n(&Msgs, NULL, __ATOMIC_SEQ_CST);
+    if (!m)
+        return;
+
+    /* Oldest first */
+    for (; m; m = next) {
+        next = m->next;
+        m->next = list;
+        list = m;
+    }
+
+    if (prompt_shown) {
+        move_to(0);
+        ceol(shown_cols);
+        move_to(0);
+    }
+
+    for (m = list; m; m = next) {
+        next = m->next;
+        for (p = m->text; *p; p++) {
+            if (*p == '\n')
+                tty_put('\r');
+            tty_put(*p);
+        }
+        if (p == m->text || p[-1] != '\n')
+            tty_puts(NEWLINE);
+        el_free(m);
+    }
+
+    if (prompt_shown) {
+        frame_reset();
+        reposition();
+    }
+}
+
 static el_status_t refresh(void)
 {
     return redisplay(1);
@@ -779,7 +1525,7 @@ int rl_refresh_line(int ignore1 __attribute__((unused)), int ignore2 __attribute
 static el_status_t toggle_meta_mode(void)
 {
     rl_meta_chars = ! rl_meta_chars;
-    return redisplay(0);
+    return CSmove;
 }
 
 const char *el_next_hist(void)
@@ -799,10 +1545,6 @@ static el_status_t do_insert_hist(const char *p)
 
     clear_line();
 
-    rl_point = 0;
-    reposition(EOF);
-    rl_end = 0;
-
     return insert_string(p);
 }
 
@@ -873,8 +1615,8 @@ static const char *search_hist(const char *search, const char *(*move)(void))
     /* Save or get remembered search pattern. */
     if (search && *search) {
         if (old_search)
-            free(old_search);
-        old_search = strdup(search);
+            el_free(old_search);
+        old_search = el_strdup(search);
     } else {
         if (old_search == NULL || *old_search == '\0')
             return NULL;
@@ -909,14 +1651,14 @@ static el_status_t h_search_end(const char *p)
     if (el_intr_pending > 0) {
         el_intr_pending = 0;
         clear_line();
-        return redisplay(0);
+        return CSmove;
     }
 
     p = search_hist(p, search_move);
     if (p == NULL) {
         el_ring_bell();
         clear_line();
-        return redisplay(0);
+        return CSmove;
     }
 
     return do_insert_hist(p);
@@ -931,13 +1673,11 @@ static el_status_t h_search(void)
     clear_line();
     old_prompt = rl_prompt;
     rl_set_prompt("Search: ");
-    reposition(EOF);
+    reposition();
 
     search_move = Repeat == NO_ARG ? el_prev_hist : el_next_hist;
-    if (line_handler) {
-        editinput(0);
-        return CSstay;
-    }
+    if (line_handler)
+        return CSstay;          /* callback_input() ends the search */
 
     return h_search_end(editinput(1));
 }
@@ -951,20 +1691,21 @@ static el_status_t fd_char(void)
             break;
         glyph_right();
     } while (++i < Repeat);
-    return CSstay;
+
+    return CSmove;
 }
 
 static void save_yank(int begin, int i)
 {
     if (Yanked) {
-        free(Yanked);
+        el_free(Yanked);
         Yanked = NULL;
     }
 
     if (i < 1)
         return;
 
-    Yanked = malloc(sizeof(char) * (i + 1));
+    Yanked = el_malloc(sizeof(char) * (i + 1));
     if (Yanked) {
         memcpy(Yanked, &rl_line_buffer[begin], i);
         Yanked[i] = '\0';
@@ -979,25 +1720,6 @@ static el_status_t delete_string(int count)
     if (count <= 0 || rl_end == rl_point)
         return el_ring_bell();
 
-    if (count == 1 && rl_point == rl_end - 1) {
-        /* Optimize common case of delete at end of line. */
-        rl_end--;
-        p = &rl_line_buffer[rl_point];
-        i = 1;
-        tty_put(' ');
-        if (ISCTL(*p)) {
-            i = 2;
-            tty_put(' ');
-        } else if (rl_meta_chars && ISMETA(*p)) {
-            i = 3;
-            tty_put(' ');
-            tty_put(' ');
-        }
-        tty_backn(i);
-        *p = '\0';
-        return CSmove;
-    }
-
     if (rl_point + count > rl_end && (count = rl_end - rl_point) <= 0)
         return CSstay;
 
@@ -1007,10 +1729,7 @@ static el_status_t delete_string(int count)
 
     for (p = &rl_line_buffer[rl_point], i = rl_end - (rl_point + count) + 1; --i >= 0; p++)
         p[0] = p[count];
-    ceol();
-
     rl_end -= count;
-    tty_string(&rl_line_buffer[rl_point]);
 
     return CSmove;
 }
@@ -1025,7 +1744,7 @@ static el_status_t bk_char(void)
         glyph_left();
     } while (++i < Repeat);
 
-    return CSstay;
+    return CSmove;
 }
 
 static el_status_t bk_del_char(void)
@@ -1049,10 +1768,9 @@ static el_status_t kill_line(void)
         if (Repeat < rl_point) {
             i = rl_point;
             rl_point = Repeat;
-            reposition(EOF);
             delete_string(i - rl_point);
         } else if (Repeat > rl_point) {
-            right(CSmove);
+            rl_point++;
             delete_string(Repeat - rl_point - 1);
         }
 
@@ -1061,46 +1779,72 @@ static el_status_t kill_line(void)
 
     save_yank(rl_point, rl_end - rl_point);
     rl_line_buffer[rl_point] = '\0';
-    ceol();
     rl_end = rl_point;
 
-    return CSstay;
+    return CSmove;
 }
 
-static el_status_t insert_char(int c)
+/* Insert glyph g, of len bytes, Repeat times */
+static el_status_t insert_glyph(const char *g, size_t len)
 {
-    el_status_t      s;
-    char        buff[2];
-    char        *p;
-    char        *q;
+    char       *p;
     int         i;
 
-    if (Repeat == NO_ARG || Repeat < 2) {
-        buff[0] = c;
-        buff[1] = '\0';
-
-        return insert_string(buff);
-    }
+    if (Repeat == NO_ARG || Repeat < 2)
+        return insert_string(g);
 
-    p = malloc(sizeof(char) * (Repeat + 1));
+    p = arena_alloc(sizeof(char) * (Repeat * len + 1));
     if (!p)
         return CSstay;
 
-    for (i = Repeat, q = p; --i >= 0; )
-        *q++ = c;
-    *q = '\0';
+    for (i = 0; i < Repeat; i++)
+        memcpy(&p[i * len], g, len);
+    p[Repeat * len] = '\0';
     Repeat = 0;
-    s = insert_string(p);
-    free(p);
 
-    return s;
+    return insert_string(p);
+}
+
+static el_status_t insert_char(int c)
+{
+    char buff[2];
+
+    buff[0] = c;
+    buff[1] = '\0';
+
+    return insert_glyph(buff, 1);
+}
+
+/* Insert the UTF-8 glyph starting with byte c as a whole, with as many of
+ * its continuation bytes as are already queued.  A byte that cannot
+ * continue it is left for the next key, so invalid input, e.g. Latin-1,
+ * is inserted byte by byte as before. */
+static el_status_t insert_utf8(int c)
+{
+    unsigned char lead = c;
+    char g[5];
+    int n = 1, need, b;
+
+    need = utf8_len(lead);
+    g[0] = c;
+    while (n < need && tty_pending()) {
+        if ((b = tty_get()) == EOF)
+            break;
+        if (!utf8_cont_ok(lead, n, b)) {
+            tty_push(b);
+            break;
+        }
+        g[n++] = b;
+    }
+    g[n] = '\0';
+
+    return insert_glyph(g, n);
 }
 
 static el_status_t beg_line(void)
 {
     if (rl_point) {
         rl_point = 0;
-        repos_key = CTL('A');
         return CSmove;
     }
 
@@ -1111,7 +1855,6 @@ static el_status_t end_line(void)
 {
     if (rl_point != rl_end) {
         rl_point = rl_end;
-        repos_key = CTL('E');
         return CSmove;
     }
 
@@ -1137,7 +1880,8 @@ el_status_t el_del_char(void)
 
 static el_status_t fd_word(void)
 {
-    return do_forward(CSmove);
+    do_forward();
+    return CSmove;
 }
 
 static el_status_t bk_word(void)
@@ -1148,143 +1892,478 @@ static el_status_t bk_word(void)
     i = 0;
     do {
         for (p = &rl_line_buffer[rl_point]; p > rl_line_buffer && !is_alpha_num(p[-1]); p--)
-            left(CSmove);
+            rl_point--;
 
         for (; p > rl_line_buffer && !isblank(p[-1]) && is_alpha_num(p[-1]); p--)
-            left(CSmove);
+            rl_point--;
 
         if (rl_point == 0)
             break;
     } while (++i < Repeat);
 
+    return CSmove;
+}
+
+/* The next key for a command that reads more than one.  In callback
+ * mode, when none is queued, the command is not to wait: KEY_WAIT is
+ * returned and 'resume' called with the key a later call brings. */
+static int key_next(el_status_t (*resume)(int c))
+{
+    if (line_handler && !tty_pending()) {
+        Resume = resume;
+        return KEY_WAIT;
+    }
+
+    return tty_get();
+}
+
+/* Run 'function' with the next key, see key_next() */
+static el_status_t key_then(el_status_t (*function)(int c))
+{
+    int c = key_next(function);
+
+    if (c == KEY_WAIT)
+        return CSstay;
+
+    return c == EOF ? CSeof : function(c);
+}
+
+/* Hand a key to the command waiting for it */
+static el_status_t key_resume(int c)
+{
+    el_status_t (*function)(int c) = Resume;
+
+    Resume = NULL;
+
+    return function(c);
+}
+
+/* Collect the text of a bracketed paste, up to ESC [ 201 ~, then insert
+ * it in one go, control characters literally rather than as key
+ * bindings.  In callback mode a paste split across calls is kept in
+ * Paste until its end arrives. */
+static el_status_t paste_key(int c)
+{
+    static const char end[] = "\x1b[201~";
+    size_t n = sizeof(end) - 1;
+    char *p;
+
+    for (; c != EOF; c = key_next(paste_key)) {
+        if (c == KEY_WAIT)
+            return CSstay;
+        if (!c)
+            continue;
+        if (PasteLen + 1 >= PasteSize) {
+            size_t size = PasteSize ? PasteSize * 2 : MEM_INC;
+
+            p = el_realloc(Paste, sizeof(char) * size);
+            if (!p)
+                break;
+            Paste = p;
+            PasteSize = size;
+        }
+
+        Paste[PasteLen++] = c;
+        if (PasteLen >= n && !memcmp(&Paste[PasteLen - n], end, n)) {
+            PasteLen -= n;
+            break;
+        }
+    }
+
+    if (Paste) {
+        Paste[PasteLen] = '\0';
+        insert_string(Paste);
+    }
+    PasteLen = 0;
+
+    return c == EOF ? CSeof : CSmove;
+}
+
+static el_status_t paste(void)
+{
+    PasteLen = 0;
+
+    return key_then(paste_key);
+}
+
+static el_status_t stay(void)
+{
     return CSstay;
 }
 
-static el_status_t meta(void)
+/*
+**  Key sequences, i.e. escape sequences and multi-key bindings, are
+**  decoded by walking a trie of their bytes, one table lookup per byte.
+**  The trie is built on first use from Escapes[], el_bind_keyseq() adds
+**  to it at runtime.
+*/
+static const struct {
+    const char       *Keys;
+    el_keymap_func_t *Function;
+} Escapes[] = {
+    {   "\e",           NULL            },  /* Meta prefix */
+#ifdef CONFIG_ANSI_ARROWS
+    /* See: https://en.wikipedia.org/wiki/ANSI_escape_code */
+    {   "\e\e[C",       fd_word         },  /* Meta+Right */
+    {   "\e\e[D",       bk_word         },  /* Meta+Left */
+    {   "\e[A",         h_prev          },  /* Up */
+    {   "\e[B",         h_next          },  /* Down */
+    {   "\e[C",         fd_char         },  /* Right */
+    {   "\e[D",         bk_char         },  /* Left */
+    {   "\e[F",         end_line        },  /* End */
+    {   "\e[H",         beg_line        },  /* Home */
+    {   "\e[1~",        beg_line        },  /* Home */
+    {   "\e[1;3C",      fd_word         },  /* Alt+Right */
+    {   "\e[1;5C",      fd_word         },  /* Ctrl+Right */
+    {   "\e[1;3D",      bk_word         },  /* Alt+Left */
+    {   "\e[1;5D",      bk_word         },  /* Ctrl+Left */
+    {   "\e[2~",        stay            },  /* Insert */
+    {   "\e[200~",      paste           },  /* Bracketed paste */
+    {   "\e[3~",        del_char        },  /* Delete */
+    {   "\e[4~",        end_line        },  /* End */
+    {   "\e[5~",        stay            },  /* PgUp */
+    {   "\e[6~",        stay            },  /* PgDn */
+    {   "\e[7~",        beg_line        },  /* Home (urxvt) */
+    {   "\e[8~",        end_line        },  /* End (urxvt) */
+    {   "\eOA",         h_prev          },
+    {   "\eOB",         h_next          },
+    {   "\eOC",         fd_char         },
+    {   "\eOD",         bk_char         },
+    {   "\eOF",         end_line        },
+    {   "\eOH",         beg_line        },
+#endif
+    {   NULL,           NULL            }
+};
+
+/* Kids of a node pruned by seq_del(), free for seq_add() to reuse */
+#define SEQ_FREE        USHRT_MAX
+
+static el_status_t seq_add(const char *seq, el_keymap_func_t function)
 {
-    int c;
-    el_keymap_t *kp;
+    size_t node = 0, next;
+    el_seqnode_t *p;
 
-    if ((c = tty_get()) == EOF)
-        return CSeof;
+    for (; *seq; seq++) {
+        next = Seq[node].Next[(unsigned char)*seq];
+        if (!next) {
+            for (next = 1; next < SeqLen && Seq[next].Kids != SEQ_FREE; next++)
+                ;
+            if (next == SeqSize) {
+                if (SeqSize * 2 > USHRT_MAX) {
+                    errno = ENOMEM;
+                    return CSeof;
+                }
+                p = el_realloc(Seq, sizeof(el_seqnode_t) * SeqSize * 2);
+                if (!p)
+                    return CSeof;
+                Seq = p;
+                SeqSize *= 2;
+            }
+            if (next == SeqLen)
+                SeqLen++;
+            memset(&Seq[next], 0, sizeof(el_seqnode_t));
+            Seq[node].Next[(unsigned char)*seq] = next;
+            Seq[node].Kids++;
+        }
+        node = next;
+    }
+    Seq[node].Function = function;
+
+    return CSdone;
+}
+
+/* Unbind the rest of 'seq' below 'node', pruning the nodes left with
+ * no kids and no function, so that e.g. C-x runs its own binding again
+ * once C-x C-s is unbound.  Returns 1 when 'node' is left unused. */
+static int seq_del(size_t node, const char *seq)
+{
+    size_t next;
+
+    if (!*seq) {
+        Seq[node].Function = NULL;
+    } else {
+        next = Seq[node].Next[(unsigned char)*seq];
+        if (!next || !seq_del(next, seq + 1))
+            return 0;
+
+        /* ESC stays, meta() starts every escape sequence there */
+        if (node || *seq != '\e') {
+            Seq[node].Next[(unsigned char)*seq] = 0;
+            Seq[node].Kids--;
+            Seq[next].Kids = SEQ_FREE;
+        }
+    }
+
+    return !Seq[node].Kids && !Seq[node].Function;
+}
+
+static int seq_init(void)
+{
+    size_t i;
+
+    if (Seq)
+        return 0;
+
+#ifdef EL_THREAD_LOCAL
+    if (DefaultSeq) {
+        Seq = el_malloc(sizeof(el_seqnode_t) * DefaultSeqSize);
+        if (!Seq)
+            return -1;
+        memcpy(Seq, DefaultSeq, sizeof(el_seqnode_t) * DefaultSeqLen);
+        SeqLen  = DefaultSeqLen;
+        SeqSize = DefaultSeqSize;
+        return 0;
+    }
+#endif
+
+    SeqSize = 32;
+    Seq = el_calloc(SeqSize, sizeof(el_seqnode_t));
+    if (!Seq)
+        return -1;
+    SeqLen = 1;
+
+    for (i = 0; Escapes[i].Keys; i++) {
+        if (seq_add(Escapes[i].Keys, Escapes[i].Function) != CSdone)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* More digits of a Meta+digit repeat count, the first other key is left
+ * for the command to repeat */
+static el_status_t meta_digit(int c)
+{
+    do {
+        if (!isdigit(c)) {
+            tty_push(c);
+            return CSstay;
+        }
+        Repeat = Repeat * 10 + c - '0';
+    } while ((c = key_next(meta_digit)) != EOF && c != KEY_WAIT);
+
+    return c == EOF ? CSeof : CSstay;
+}
+
+/* Meta+key, i.e. ESC followed by a key that does not start a sequence */
+static el_status_t meta_key(int c)
+{
+    if (isdigit(c)) {
+        Repeat = 0;
+        return meta_digit(c);
+    }
+
+    if (isupper(c))
+        return do_macro(c);
+
+    if (MetaMap[(unsigned char)c])
+        return MetaMap[(unsigned char)c]();
+
+    return el_ring_bell();
+}
+
+/* Run the single key binding of 'c' */
+static el_status_t key_run(int c)
+{
+    el_keymap_func_t *function = Map[(unsigned char)c];
+    el_status_t s;
+
+    if (!function)
+        return utf8_len(c) > 1 ? insert_utf8(c) : insert_char(c);
+
+    s = function();
+    if (s == CSdispatch)	/* If Function is inhibited. */
+        s = insert_char(c);
+
+    return s;
+}
+
+/* Feed key 'c' to the decoder, returns 0 while the sequence is incomplete.
+ * A key that does not continue the sequence is left for the binding of
+ * the sequence so far.  An unknown CSI sequence is read up to its final
+ * byte and an unknown SS3 sequence is one byte long, so no part of it
+ * ends up in the line. */
+static int seq_feed(int c, el_status_t *s)
+{
+    size_t next;
+
+    if (Keyseq.Csi) {
+        /* Parameter and intermediate bytes, up to the final byte */
+        if (c >= 0x20 && c < 0x40)
+            return 0;
+        if (c < 0x20)
+            tty_push(c);
+        Keyseq.Active = 0;
+        *s = el_ring_bell();
+        return 1;
+    }
+
+    next = Seq[Keyseq.Node].Next[(unsigned char)c];
+    if (!next) {
+        Keyseq.Active = 0;
+        if (Seq[Keyseq.Node].Function) {
+            tty_push(c);
+            *s = Seq[Keyseq.Node].Function();
+        } else if (Keyseq.Depth == 1 && Keyseq.First == '\e') {
+            *s = meta_key(c);
+        } else if (Keyseq.Depth == 1) {
+            tty_push(c);
+            *s = key_run(Keyseq.First);
+        } else if (Keyseq.Lead == '[') {
+            Keyseq.Active = 1;
+            Keyseq.Csi = 1;
+            return seq_feed(c, s);
+        } else {
+            *s = el_ring_bell();
+        }
+        return 1;
+    }
+
+    if (Keyseq.First == '\e' && !Keyseq.Lead && c != '\e')
+        Keyseq.Lead = c;
+    Keyseq.Node = next;
+    Keyseq.Depth++;
+    if (Seq[next].Kids)
+        return 0;
+
+    Keyseq.Active = 0;
+    *s = Seq[next].Function ? Seq[next].Function() : el_ring_bell();
+    return 1;
+}
+
+/* No more input within el_esc_timeout after ESC: what there is of a
+ * sequence is taken as is, a lone ESC makes the next key, whenever it
+ * comes, Meta. */
+static el_status_t esc_timeout(void)
+{
+    Keyseq.Active = 0;
+    if (Keyseq.Depth == 1) {
+        Keyseq.Meta = 1;
+        return CSstay;
+    }
+    if (!Keyseq.Csi && Seq[Keyseq.Node].Function)
+        return Seq[Keyseq.Node].Function();
+
+    return el_ring_bell();
+}
+
+/* Run the decoder on what input arrives, escape sequences only in time.
+ * In callback mode it does not wait but returns, to be resumed by the
+ * next key, or timed out once el_callback_timeout() has run out. */
+static el_status_t seq_more(void)
+{
+    el_status_t s;
+    int esc = Keyseq.First == '\e', ms;
+    int c;
 
-#ifdef CONFIG_ANSI_ARROWS
-    /* See: https://en.wikipedia.org/wiki/ANSI_escape_code */
-    /* Recognize ANSI escapes for `Meta+Left` and `Meta+Right`. */
-    if (c == '\e') {
-        switch (tty_get()) {
-        case '[':
-        {
-            switch (tty_get()) {
-            /* \e\e[C = Meta+Left */
-            case 'C': return fd_word();
-            /* \e\e[D = Meta+Right */
-            case 'D': return bk_word();
-            default:
-                break;
+    while (1) {
+        ms = esc ? el_esc_timeout : -1;
+        if (!tty_wait(line_handler ? 0 : ms)) {
+            if (esc && (!line_handler || !ms))
+                return esc_timeout();
+            if (!esc || ms < 0)
+                return CSstay;
+
+            clock_gettime(CLOCK_MONOTONIC, &Keyseq.Deadline);
+            Keyseq.Deadline.tv_sec  += ms / 1000;
+            Keyseq.Deadline.tv_nsec += (ms % 1000) * 1000000L;
+            if (Keyseq.Deadline.tv_nsec >= 1000000000L) {
+                Keyseq.Deadline.tv_sec++;
+                Keyseq.Deadline.tv_nsec -= 1000000000L;
             }
-
-            return el_ring_bell();
-        }
-        default:
-            break;
+            return CSstay;
         }
 
-        return el_ring_bell();
+        if ((c = tty_get()) == EOF) {
+            Keyseq.Active = 0;
+            return CSeof;
+        }
+        if (seq_feed(c, &s))
+            return s;
     }
+}
 
-    /* Also include VT-100 arrows. */
-    if (c == '[' || c == 'O') {
-        switch (tty_get()) {
-        case EOF:  return CSeof;
-        case '1':
-        {
-            char seq[4] = { 0 };
-            seq[0] = tty_get();
+/* Start decoding a key sequence, the first key already read */
+static el_status_t seq_start(int c, size_t node)
+{
+    Keyseq.Active = 1;
+    Keyseq.Csi    = 0;
+    Keyseq.First  = c;
+    Keyseq.Lead   = 0;
+    Keyseq.Depth  = 1;
+    Keyseq.Node   = node;
 
-            /* \e[1~ */
-            if (seq[0] == '~')
-                return beg_line(); /* Home */
+    return seq_more();
+}
 
-            for (c = 1; c < 3; c++)
-                seq[c] = tty_get();
+static el_status_t seq_resume(int c)
+{
+    el_status_t s;
 
-            if (!strncmp(seq, ";5C", 3)
-                || !strncmp(seq, ";3C", 3))
-                return fd_word(); /* \e[1;5C = Ctrl+Right */
-            if (!strncmp(seq, ";5D", 3)
-                || !strncmp(seq, ";3D", 3))
-                return bk_word(); /* \e[1;5D = Ctrl+Left */
+    if (seq_feed(c, &s))
+        return s;
 
-            break;
-        }
-        case '2':  tty_get(); return CSstay;     /* Insert */
-        case '3':  tty_get(); return del_char(); /* Delete */
-        case '4':  tty_get(); return end_line(); /* End */
-        case '5':  tty_get(); return CSstay;     /* PgUp */
-        case '6':  tty_get(); return CSstay;     /* PgDn */
-        case '7':  tty_get(); return beg_line(); /* Home (urxvt) */
-        case '8':  tty_get(); return end_line(); /* End (urxvt) */
-        case 'A':  return h_prev();              /* Up */
-        case 'B':  return h_next();              /* Down */
-        case 'C':  return fd_char();             /* Left */
-        case 'D':  return bk_char();             /* Right */
-        case 'F':  return end_line();            /* End */
-        case 'H':  return beg_line();            /* Home */
-        default:                                 /* Fall through */
-            break;
-        }
+    return seq_more();
+}
 
+static el_status_t meta(void)
+{
+    if (seq_init())
         return el_ring_bell();
-    }
-#endif /* CONFIG_ANSI_ARROWS */
 
-    if (isdigit(c)) {
-        for (Repeat = c - '0'; (c = tty_get()) != EOF && isdigit(c); )
-            Repeat = Repeat * 10 + c - '0';
-        tty_push(c);
+    return seq_start('\e', Seq[0].Next['\e']);
+}
 
-        return CSstay;
-    }
+/* Milliseconds until rl_callback_read_char() should be called, even with
+ * no input, to time out a pending escape sequence, or -1 if none is. */
+int el_callback_timeout(void)
+{
+    struct timespec now;
+    long ms;
 
-    if (isupper(c))
-        return do_macro(c);
+    if (!Keyseq.Active || Keyseq.First != '\e' || el_esc_timeout < 0)
+        return -1;
 
-    for (kp = MetaMap; kp->Function; kp++) {
-        if (kp->Key == c)
-            return kp->Function();
-    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (Keyseq.Deadline.tv_sec - now.tv_sec) * 1000
+        + (Keyseq.Deadline.tv_nsec - now.tv_nsec) / 1000000;
 
-    return el_ring_bell();
+    return ms < 0 ? 0 : (int)ms;
+}
+
+/* True when called back at the deadline of a pending escape sequence */
+static int seq_expired(void)
+{
+    return Keyseq.Active && !tty_pending() && !el_callback_timeout();
 }
 
 static el_status_t emacs(int c)
 {
-    el_status_t  s;
-    el_keymap_t *kp;
+    el_status_t s;
+    size_t      node;
 
     /* Save point before interpreting input character 'c'. */
     old_point = rl_point;
 
-    if (rl_meta_chars && ISMETA(c)) {
-        tty_push(UNMETA(c));
+    if (Keyseq.Meta) {
+        Keyseq.Meta = 0;
+        tty_push(c);
         return meta();
     }
-
-    for (kp = Map; kp->Function; kp++) {
-        if (kp->Key == c)
-            break;
+    if (rl_meta_chars && ISMETA(c) && !Keyseq.Active) {
+        tty_push(UNMETA(c));
+        return meta();
     }
 
-    if (kp->Function) {
-        s = kp->Function();
-        if (s == CSdispatch)	/* If Function is inhibited. */
-            s = insert_char(c);
-    } else {
-        s = insert_char(c);
-    }
+    node = Seq ? Seq[0].Next[(unsigned char)c] : 0;
+    if (Keyseq.Active)
+        s = seq_resume(c);
+    else if (node && Seq[node].Kids)
+        s = seq_start(c, node);
+    else
+        s = key_run(c);
 
-    if (!el_pushed) {
+    if (!el_pushed && !Keyseq.Active && !Resume) {
         /* No pushback means no repeat count; hacky, but true. */
         Repeat = NO_ARG;
     }
@@ -1336,14 +2415,29 @@ static el_status_t tty_special(int c)
 
 static char *editinput(int complete)
 {
+    el_status_t s;
     int c;
 
     do {
-        c = tty_get();
-        if (c == EOF)
-            break;
+        if (seq_expired()) {
+            s = esc_timeout();
+        } else {
+            c = tty_get();
+            if (c == EOF)
+                break;
+
+            if (Resume) {
+                s = key_resume(c);
+                if (!el_pushed && !Resume)
+                    Repeat = NO_ARG;
+            } else {
+                s = tty_special(c);
+                if (s == CSdispatch)
+                    s = emacs(c);
+            }
+        }
 
-        switch (tty_special(c)) {
+        switch (s) {
         case CSdone:
             return rl_line_buffer;
 
@@ -1354,33 +2448,15 @@ static char *editinput(int complete)
             return (char *)"";
 
         case CSmove:
-            reposition(c);
-            break;
-
         case CSdispatch:
-            switch (emacs(c)) {
-            case CSdone:
-                return rl_line_buffer;
-
-            case CSeof:
-                return NULL;
-
-            case CSsignal:
-                return (char *)"";
-
-            case CSmove:
-                reposition(c);
-                break;
-
-            case CSdispatch:
-            case CSstay:
-                break;
-            }
-            break;
-
         case CSstay:
             break;
         }
+
+        /* Draw a multibyte glyph once it is complete, not byte by byte,
+         * and a paste or fast typing once it has all been read. */
+        if (!glyph_pending() && !tty_pending())
+            reposition();
     } while (complete);
 
     return NULL;
@@ -1389,7 +2465,14 @@ static char *editinput(int complete)
 static void hist_alloc(void)
 {
     if (!H.Lines)
-        H.Lines = calloc(1 + el_hist_size, sizeof(char *));
+        H.Lines = el_calloc(1 + el_hist_size, sizeof(char *));
+}
+
+/* The entry for the line being edited is NILSTR, not allocated */
+static void hist_free(char *p)
+{
+    if (p != NILSTR)
+        el_free(p);
 }
 
 static void hist_add(const char *p)
@@ -1402,14 +2485,14 @@ static void hist_add(const char *p)
         return;
 #endif
 
-    s = strdup(p);
+    s = p == NILSTR ? NILSTR : el_strdup(p);
     if (s == NULL)
         return;
 
     if (H.Size <= el_hist_size) {
         H.Lines[H.Size++] = s;
     } else {
-        free(H.Lines[0]);
+        hist_free(H.Lines[0]);
         for (i = 0; i < el_hist_size; i++)
             H.Lines[i] = H.Lines[i + 1];
         H.Lines[i] = s;
@@ -1417,45 +2500,45 @@ static void hist_add(const char *p)
     H.Pos = H.Size - 1;
 }
 
+/* Read a line from a file or pipe: scan the input buffer for the newline
+ * a chunk at a time, leaving what follows for the next line. */
 static char *read_redirected(void)
 {
-    int         size = MEM_INC;
-    char        *p;
-    char        *line;
-    const char  *end;
+    size_t      len = 0, size = 0, n;
+    char        *line = NULL;
+    char        *nl, *p;
 
-    p = line = malloc(sizeof(char) * size);
-    if (!p)
-        return NULL;
-
-    end = p + size;
     while (1) {
-        if (p == end) {
-            int oldpos = end - line;
+        if (!input_fill()) {
+            /* Ignore "incomplete" lines at EOF, just like we do for a tty. */
+            el_free(line);
+            return NULL;
+        }
 
-            size += MEM_INC;
-            p = realloc(line, sizeof(char) * size);
+        n = input_len - input_pos;
+        nl = memchr(&Input[input_pos], '\n', n);
+        if (nl)
+            n = nl - &Input[input_pos];
+
+        if (len + n + 1 > size) {
+            size = MAX(size * 2, len + n + MEM_INC);
+            p = el_realloc(line, sizeof(char) * size);
             if (!p) {
-		free(line);
+                el_free(line);
                 return NULL;
-	    }
-	    line = p;
-            end = p + size;
-
-            p += oldpos;        /* Continue where we left off... */
-        }
-
-        if (read(el_infd, p, 1) <= 0) {
-            /* Ignore "incomplete" lines at EOF, just like we do for a tty. */
-            free(line);
-            return NULL;
+            }
+            line = p;
         }
 
-        if (*p == '\n')
+        memcpy(&line[len], &Input[input_pos], n);
+        len += n;
+        input_pos += n;
+        if (nl) {
+            input_pos++;
             break;
-        p++;
+        }
     }
-    *p = '\0';
+    line[len] = '\0';
 
     return line;
 }
@@ -1477,17 +2560,32 @@ void rl_reset_terminal(const char *terminal_name)
         el_term = "dumb";
     }
 
+    /* Anything smarter than a dumb terminal is expected to insert and
+     * delete characters, and erase to end of line and screen, with the
+     * ECMA-48 sequences, unless termcap knows better. */
+    tty_can_edit = *el_term && strcmp(el_term, "dumb");
+
     /* Initialize to faulty values to trigger fallback if nothing else works. */
     tty_cols = tty_rows = -1;
 
 #ifdef CONFIG_USE_TERMCAP
-    bp = buf;
-    if (1 == tgetent(buf, el_term)) {
+    /* The strings are kept in tc_area, rewritten on every call */
+    backspace = "\b";
+    tc_ich = tc_dch = tc_el = tc_ed = NULL;
+    if (!tc_area)
+        tc_area = el_malloc(sizeof(buf));
+    bp = tc_area;
+    if (bp && 1 == tgetent(buf, el_term)) {
         char *maybe_backspace = tgetstr("le", &bp);
         if (maybe_backspace != NULL)
-            backspace = strdup(maybe_backspace);
+            backspace = maybe_backspace;
         tty_cols = tgetnum("co");
         tty_rows = tgetnum("li");
+        tc_ich = tgetstr("IC", &bp);
+        tc_dch = tgetstr("DC", &bp);
+        tc_el  = tgetstr("ce", &bp);
+        tc_ed  = tgetstr("cd", &bp);
+        tty_can_edit = tc_ich && tc_dch && tc_el && tc_ed;
     }
     /* Make sure to check width & rows and fallback to TIOCGWINSZ if available. */
 #endif
@@ -1525,46 +2623,96 @@ void rl_restore_prompt(void)
 
 void rl_initialize(void)
 {
+    struct stat st;
+
     if (!rl_prompt)
         rl_set_prompt("? ");
 
     hist_alloc();
+#ifdef EL_THREAD_LOCAL
+    if (DefaultSeq)
+        seq_init();
+#endif
 
-    /* Setup I/O descriptors */
-    if (!rl_instream)  el_infd  = EL_STDIN;
-    else               el_infd  = fileno(rl_instream);
-    if (el_infd < 0)   el_infd  = EL_STDIN;
-    if (!rl_outstream) el_outfd = EL_STDOUT;
-    else               el_outfd = fileno(rl_outstream);
-    if (el_outfd < 0)  el_outfd = EL_STDOUT;
+    /* Setup I/O descriptors, other sessions have their own */
+    if (el_cur == &el_default) {
+        if (!rl_instream)  el_infd  = EL_STDIN;
+        else               el_infd  = fileno(rl_instream);
+        if (el_infd < 0)   el_infd  = EL_STDIN;
+        if (!rl_outstream) el_outfd = EL_STDOUT;
+        else               el_outfd = fileno(rl_outstream);
+        if (el_outfd < 0)  el_outfd = EL_STDOUT;
+    }
+    out_sock = !fstat(el_outfd, &st) && S_ISSOCK(st.st_mode);
 }
 
 void rl_uninitialize(void)
 {
+    el_msg_t *m, *next;
     int i;
 
     /* Uninitialize the history */
     if (H.Lines) {
         for (i = 0; i <= el_hist_size; i++) {
             if (H.Lines[i])
-                free(H.Lines[i]);
+                hist_free(H.Lines[i]);
             H.Lines[i] = NULL;
         }
-        free(H.Lines);
+        el_free(H.Lines);
         H.Lines = NULL;
     }
     H.Size = 0;
     H.Pos = 0;
 
     if (old_search)
-        free(old_search);
+        el_free(old_search);
     old_search = NULL;
 
     /* Uninitialize the line buffer */
     if (rl_line_buffer)
-        free(rl_line_buffer);
+        el_free(rl_line_buffer);
     rl_line_buffer = NULL;
     Length = 0;
+
+    if (Shown)
+        el_free(Shown);
+    Shown = NULL;
+    ShownSize = 0;
+
+    arena_reset(0);
+
+    el_free(Yanked);
+    Yanked = NULL;
+    el_free(ColIndex);
+    ColIndex = NULL;
+    ColIndexSize = col_valid = 0;
+    el_free(el_cur->tty_save);
+    el_cur->tty_save = NULL;
+    el_free(tc_area);
+    tc_area = NULL;
+    tc_ich = tc_dch = tc_el = tc_ed = NULL;
+    backspace = "\b";
+
+    /* Thread-local builds keep the default bindings in DefaultSeq */
+    el_free(Seq);
+    Seq = NULL;
+    SeqLen = SeqSize = 0;
+
+    el_free(Paste);
+    Paste = NULL;
+    PasteLen = PasteSize = 0;
+
+    /* Drop messages not shown, el_session_post() may still add more */
+    for (m = __atomic_exchange_n(&Msgs, NULL, __ATOMIC_SEQ_CST); m; m = next) {
+        next = m->next;
+        el_free(m);
+    }
+
+    /* Uninitialize the output buffer */
+    if (Screen)
+        el_free(Screen);
+    Screen = NULL;
+    ScreenSize = ScreenCount = 0;
 }
 
 void rl_clear_message(void)
@@ -1584,36 +2732,52 @@ static int el_prep(const char *prompt)
 
     if (!rl_line_buffer) {
         Length = MEM_INC;
-        rl_line_buffer = malloc(sizeof(char) * Length);
+        rl_line_buffer = el_malloc(sizeof(char) * Length);
         if (!rl_line_buffer)
             return -1;
     }
 
     tty_info();
     rl_prep_term_function(!rl_meta_chars);
+#ifdef CONFIG_ANSI_ARROWS
+    if (!el_no_bracketed_paste && !el_no_echo && strcmp(el_term, "dumb")) {
+        tty_puts("\x1b[?2004h");
+        paste_mode = 1;
+    }
+#endif
     hist_add(NILSTR);
-    ScreenSize = SCREEN_INC;
-    Screen = malloc(sizeof(char) * ScreenSize);
-    if (!Screen)
-        return -1;
+    if (!Screen) {
+        ScreenSize = SCREEN_INC;
+        Screen = el_malloc(sizeof(char) * ScreenSize);
+        if (!Screen)
+            return -1;
+    }
 
     rl_set_prompt(prompt);
 
+    Repeat = NO_ARG;
+    old_point = rl_point = rl_mark = rl_end = 0;
+    rl_line_buffer[0] = '\0';
+
+    frame_reset();
+    msg_show();
     if (el_no_echo) {
         int old = el_no_echo;
 
         el_no_echo = 0;
-        tty_puts(rl_prompt);
+        reposition();
         tty_flush();
         el_no_echo = old;
     } else {
-        tty_puts(rl_prompt);
+        reposition();
     }
 
-    Repeat = NO_ARG;
-    old_point = rl_point = rl_mark = rl_end = 0;
-    rl_line_buffer[0] = '\0';
     el_intr_pending = -1;
+    input_eof = 0;
+    Keyseq.Active = 0;
+    Keyseq.Meta = 0;
+    Resume = NULL;
+    PasteLen = 0;
 
     return 0;
 }
@@ -1621,19 +2785,22 @@ static int el_prep(const char *prompt)
 static char *el_deprep(char *line)
 {
     if (line) {
-        line = strdup(line);
+        line = el_strdup(line);
+        reposition_end();
         tty_puts(NEWLINE);
-        tty_flush();
     }
+    if (paste_mode) {
+        tty_puts("\x1b[?2004l");
+        paste_mode = 0;
+    }
+    tty_flush();
+    frame_reset();
 
     rl_deprep_term_function();
-    if (Screen) {
-        free(Screen);
-        Screen = NULL;
-    }
 
-    free(H.Lines[--H.Size]);
+    hist_free(H.Lines[--H.Size]);
     H.Lines[H.Size] = NULL;
+    arena_reset(1);
 
     /* Add to history, unless no-echo or no-history mode ... */
     if (!el_no_echo && !el_no_hist) {
@@ -1641,16 +2808,84 @@ static char *el_deprep(char *line)
             hist_add(line);
     }
 
+    /* Only a terminal's own user may signal us, not a client on a socket */
     if (el_intr_pending > 0) {
         int signo = el_intr_pending;
 
         el_intr_pending = 0;
-        kill(getpid(), signo);
+        if (isatty(el_infd))
+            kill(getpid(), signo);
     }
 
     return line;
 }
 
+/* True if there is no key to handle, nor a deadline to act on.  Saves a
+ * read of a non-blocking el_infd on a spurious wakeup. */
+static int callback_idle(void)
+{
+    if (seq_expired())
+        return 0;
+    if (feed || rl_getc_function == rl_getc)
+        return !tty_pending();
+
+    return 0;
+}
+
+/* Handle callback input, until no more keys are buffered or, with
+ * el_callback_drain, until el_infd has no more to read either. */
+static void callback_input(void)
+{
+    char *line;
+
+    msg_show();
+
+    /* Keys already read into the input buffer do not make el_infd
+     * readable again, so they are all handled before returning. */
+    do {
+        el_session_t *cur = el_cur;
+        rl_vcpfunc_t *handler = line_handler;
+        char *l;
+
+        if (callback_idle())
+            break;
+
+        line = editinput(0);
+        if (!line) {
+            if (input_eof)
+                break;
+            continue;
+        }
+
+        if (Searching) {
+            h_search_end(line);
+            continue;
+        }
+
+        l = el_deprep(line);
+        handler(l);
+
+        /* The handler may have removed itself, or freed the session */
+        if (el_cur != cur || line_handler != handler)
+            return;
+
+        if (el_prep(rl_prompt)) {
+            line_handler(NULL);
+            break;
+        }
+    } while (line_handler && (el_callback_drain ? tty_pending() : tty_buffered()));
+    tty_flush();
+
+    /* End of file: the handler is removed, then called with NULL */
+    if (input_eof && line_handler) {
+        rl_vcpfunc_t *handler = line_handler;
+
+        el_deprep(NULL);
+        line_handler = NULL;
+        handler(NULL);
+    }
+}
+
 void rl_callback_handler_install(const char *prompt, rl_vcpfunc_t *lhandler)
 {
     if (!lhandler)
@@ -1666,21 +2901,20 @@ void rl_callback_handler_install(const char *prompt, rl_vcpfunc_t *lhandler)
 }
 
 /*
- * Reads one character at a time, when a complete line has been received
- * the lhandler from rl_callback_handler_install() is called with the
- * line as argument.
+ * Reads one character at a time, and any more already buffered, when a
+ * complete line has been received the lhandler from
+ * rl_callback_handler_install() is called with the line as argument.
  *
  * If the callback returns the terminal is prepped for reading a new
  * line.
  *
  * If any error occurs, either in the _install() phase, or while reading
  * one character, this function restores the terminal and calls lhandler
- * with a NULL argument.
+ * with a NULL argument.  So it does at end of file, after removing the
+ * handler, while no input yet on a non-blocking el_infd just returns.
  */
 void rl_callback_read_char(void)
 {
-    char *line;
-
     if (!line_handler) {
         errno = EINVAL;
         return;
@@ -1696,23 +2930,36 @@ void rl_callback_read_char(void)
         return;
     }
 
-    line = editinput(0);
-    if (line) {
-        char *l;
-
-        if (Searching) {
-            h_search_end(line);
-            tty_flush();
-            return;
-        }
+    callback_input();
+}
 
-        l = el_deprep(line);
-        line_handler(l);
+/*
+ * Like rl_callback_read_char(), but for input the application has read
+ * itself, e.g. from a socket.  All of 'buf' is handled, and the line is
+ * drawn, once, before returning.  Call with len 0 when the deadline from
+ * el_callback_timeout() has passed.  el_infd is never read: a command
+ * that reads more keys, like quote or a bracketed paste, is continued
+ * by the next call when 'buf' runs out.
+ */
+void rl_callback_read_chars(const char *buf, size_t len)
+{
+    if (!line_handler) {
+        errno = EINVAL;
+        return;
+    }
 
-        if (el_prep(rl_prompt))
-            line_handler(NULL);
+    if (!Screen || !rl_line_buffer) {
+        errno = ENOMEM;
+        line_handler(el_deprep(NULL));
+        return;
     }
-    tty_flush();
+
+    feed = buf ? buf : "";
+    feed_len = buf ? len : 0;
+    feed_pos = 0;
+    callback_input();
+    feed = NULL;
+    feed_len = feed_pos = 0;
 }
 
 void rl_callback_handler_remove(void)
@@ -1750,6 +2997,7 @@ void add_history(const char *p)
     if (p == NULL || *p == '\0')
         return;
 
+    hist_alloc();
     hist_add(p);
 }
 
@@ -1764,15 +3012,15 @@ static char *read_line(FILE *fp)
     char *line, *tmp;
     int c;
 
-    line = malloc(size);
+    line = el_malloc(size);
     if (!line)
 	return NULL;
 
     while ((c = getc(fp)) != EOF && c != '\n') {
 	if (len + 1 >= size) {
-	    tmp = realloc(line, size + MEM_INC);
+	    tmp = el_realloc(line, size + MEM_INC);
 	    if (!tmp) {
-		free(line);
+		el_free(line);
 		return NULL;
 	    }
 	    line = tmp;
@@ -1782,7 +3030,7 @@ static char *read_line(FILE *fp)
     }
 
     if (c == EOF && len == 0) {
-	free(line);
+	el_free(line);
 	return NULL;
     }
 
@@ -1804,7 +3052,7 @@ int read_history(const char *filename)
     H.Size = 0;
     while (H.Size < el_hist_size && (line = read_line(fp)) != NULL) {
 	add_history(line);
-	free(line);
+	el_free(line);
     }
 
     return fclose(fp);
@@ -1832,10 +3080,10 @@ int write_history(const char *filename)
 }
 
 /*
-**  Move back to the beginning of the current word and return an
-**  allocated copy of it.
+**  Move back to the beginning of the current word and return a copy of
+**  it, in the line's scratch memory.
 */
-char *el_find_word(void)
+static char *find_word(void)
 {
     char        *p, *q;
     char        *word;
@@ -1855,7 +3103,7 @@ char *el_find_word(void)
     }
 
     len = rl_point - (p - rl_line_buffer) + 1;
-    word = malloc(sizeof(char) * len);
+    word = arena_alloc(sizeof(char) * len);
     if (!word)
         return NULL;
 
@@ -1872,21 +3120,27 @@ char *el_find_word(void)
     return word;
 }
 
+/* As find_word(), but an allocated copy */
+char *el_find_word(void)
+{
+    char *word = find_word();
+
+    return word ? el_strdup(word) : NULL;
+}
+
 static el_status_t c_possible(void)
 {
     char        **av;
     char        *word;
     int         ac;
 
-    word = el_find_word();
+    word = find_word();
     ac = rl_list_possib(word, &av);
-    if (word)
-        free(word);
     if (ac) {
         el_print_columns(ac, av);
         while (--ac >= 0)
-            free(av[ac]);
-        free(av);
+            el_free(av[ac]);
+        el_free(av);
 
         return CSmove;
     }
@@ -1905,17 +3159,15 @@ static el_status_t c_complete(void)
     if (rl_inhibit_complete)
         return CSdispatch;
 
-    word = el_find_word();
+    word = find_word();
     p = rl_complete(word, &unique);
-    if (word)
-        free(word);
     if (p) {
         len = strlen(p);
         word = p;
 
-        string = q = malloc(sizeof(char) * (2 * len + 1));
+        string = q = arena_alloc(sizeof(char) * (2 * len + 1));
         if (!string) {
-            free(word);
+            el_free(word);
             return CSstay;
         }
 
@@ -1928,7 +3180,7 @@ static el_status_t c_complete(void)
             *q++ = *p++;
         }
         *q = '\0';
-        free(word);
+        el_free(word);
 
         if (len > 0) {
             s = insert_string(string);
@@ -1937,7 +3189,6 @@ static el_status_t c_complete(void)
                 el_ring_bell();
 #endif
         }
-        free(string);
 
         if (len > 0)
             return s;
@@ -1956,25 +3207,20 @@ static el_status_t transpose(void)
 {
     char        c;
 
-    if (rl_point) {
-        if (rl_point == rl_end)
-            left(CSmove);
+    if (rl_point == rl_end)
+        rl_point--;
+    if (rl_point > 0) {
         c = rl_line_buffer[rl_point - 1];
-        left(CSstay);
         rl_line_buffer[rl_point - 1] = rl_line_buffer[rl_point];
-        tty_show(rl_line_buffer[rl_point - 1]);
         rl_line_buffer[rl_point++] = c;
-        tty_show(c);
     }
 
-    return CSstay;
+    return CSmove;
 }
 
 static el_status_t quote(void)
 {
-    int c;
-
-    return (c = tty_get()) == EOF ? CSeof : insert_char((int)c);
+    return key_then(insert_char);
 }
 
 static el_status_t mk_set(void)
@@ -1983,12 +3229,10 @@ static el_status_t mk_set(void)
     return CSstay;
 }
 
-static el_status_t exchange(void)
+static el_status_t exchange_key(int c)
 {
-    int c;
-
-    if ((c = tty_get()) != CTL('X'))
-        return c == EOF ? CSeof : el_ring_bell();
+    if (c != CTL('X'))
+        return el_ring_bell();
 
     if ((c = rl_mark) <= rl_end) {
         rl_mark = rl_point;
@@ -1999,6 +3243,11 @@ static el_status_t exchange(void)
     return CSstay;
 }
 
+static el_status_t exchange(void)
+{
+    return key_then(exchange_key);
+}
+
 static el_status_t yank(void)
 {
     if (Yanked && *Yanked)
@@ -2020,14 +3269,11 @@ static el_status_t copy_region(void)
     return CSstay;
 }
 
-static el_status_t move_to_char(void)
+static el_status_t move_to_char_key(int c)
 {
-    int i, c;
+    int i;
     char *p;
 
-    if ((c = tty_get()) == EOF)
-        return CSeof;
-
     for (i = rl_point + 1, p = &rl_line_buffer[i]; i < rl_end; i++, p++) {
         if (*p == c) {
             rl_point = i;
@@ -2038,11 +3284,16 @@ static el_status_t move_to_char(void)
     return CSstay;
 }
 
+static el_status_t move_to_char(void)
+{
+    return key_then(move_to_char_key);
+}
+
 static el_status_t fd_kill_word(void)
 {
     int i;
 
-    do_forward(CSstay);
+    do_forward();
     if (old_point != rl_point) {
         i = rl_point - old_point;
         rl_point = old_point;
@@ -2070,7 +3321,7 @@ static int argify(char *line, char ***avp)
     int         i;
 
     i = MEM_INC;
-    *avp = p = malloc(sizeof(char *) * i);
+    *avp = p = arena_alloc(sizeof(char *) * i);
     if (!p)
         return 0;
 
@@ -2089,7 +3340,7 @@ static int argify(char *line, char ***avp)
         *c++ = '\0';
         if (*c && *c != '\n') {
             if (ac + 1 == i) {
-                arg = malloc(sizeof(char *) * (i + MEM_INC));
+                arg = arena_alloc(sizeof(char *) * (i + MEM_INC));
                 if (!arg) {
                     p[ac] = NULL;
                     return ac;
@@ -2097,7 +3348,6 @@ static int argify(char *line, char ***avp)
 
                 memcpy(arg, p, i * sizeof(char *));
                 i += MEM_INC;
-                free(p);
                 *avp = p = arg;
             }
             p[ac++] = c;
@@ -2114,133 +3364,153 @@ static el_status_t last_argument(void)
 {
     char      **av = NULL;
     char       *p;
-    el_status_t s;
     int         ac;
 
     if (H.Size == 1 || (p = (char *)H.Lines[H.Size - 2]) == NULL)
         return el_ring_bell();
 
-    p = strdup(p);
+    p = arena_strdup(p);
     if (!p)
         return CSstay;
 
     ac = argify(p, &av);
     if (Repeat != NO_ARG)
-        s = Repeat < ac ? insert_string(av[Repeat]) : el_ring_bell();
-    else
-        s = ac ? insert_string(av[ac - 1]) : CSstay;
-
-    if (av)
-        free(av);
-    free(p);
-
-    return s;
-}
-
-static el_keymap_t Map[64] = {
-    {   CTL('@'),       mk_set          },
-    {   CTL('A'),       beg_line        },
-    {   CTL('B'),       bk_char         },
-    {   CTL('D'),       del_char        },
-    {   CTL('E'),       end_line        },
-    {   CTL('F'),       fd_char         },
-    {   CTL('G'),       el_ring_bell    },
-    {   CTL('H'),       bk_del_char     },
-    {   CTL('I'),       c_complete      },
-    {   CTL('J'),       accept_line     },
-    {   CTL('K'),       kill_line       },
-    {   CTL('L'),       refresh         },
-    {   CTL('M'),       accept_line     },
-    {   CTL('N'),       h_next          },
-    {   CTL('O'),       el_ring_bell    },
-    {   CTL('P'),       h_prev          },
-    {   CTL('Q'),       el_ring_bell    },
-    {   CTL('R'),       h_search        },
-    {   CTL('S'),       el_ring_bell    },
-    {   CTL('T'),       transpose       },
-    {   CTL('U'),       el_ring_bell    },
-    {   CTL('V'),       quote           },
-    {   CTL('W'),       bk_kill_word    },
-    {   CTL('X'),       exchange        },
-    {   CTL('Y'),       yank            },
-    {   CTL('Z'),       el_ring_bell    },
-    {   CTL('['),       meta            },
-    {   CTL(']'),       move_to_char    },
-    {   CTL('^'),       el_ring_bell    },
-    {   CTL('_'),       el_ring_bell    },
-    {   0,              NULL            }
+        return Repeat < ac ? insert_string(av[Repeat]) : el_ring_bell();
+
+    return ac ? insert_string(av[ac - 1]) : CSstay;
+}
+
+/* Direct-indexed by key, one plane for plain keys and one for Meta */
+static el_keymap_func_t *DefaultMap[256] = {
+    [CTL('@')]      = mk_set,
+    [CTL('A')]      = beg_line,
+    [CTL('B')]      = bk_char,
+    [CTL('D')]      = del_char,
+    [CTL('E')]      = end_line,
+    [CTL('F')]      = fd_char,
+    [CTL('G')]      = el_ring_bell,
+    [CTL('H')]      = bk_del_char,
+    [CTL('I')]      = c_complete,
+    [CTL('J')]      = accept_line,
+    [CTL('K')]      = kill_line,
+    [CTL('L')]      = refresh,
+    [CTL('M')]      = accept_line,
+    [CTL('N')]      = h_next,
+    [CTL('O')]      = el_ring_bell,
+    [CTL('P')]      = h_prev,
+    [CTL('Q')]      = el_ring_bell,
+    [CTL('R')]      = h_search,
+    [CTL('S')]      = el_ring_bell,
+    [CTL('T')]      = transpose,
+    [CTL('U')]      = el_ring_bell,
+    [CTL('V')]      = quote,
+    [CTL('W')]      = bk_kill_word,
+    [CTL('X')]      = exchange,
+    [CTL('Y')]      = yank,
+    [CTL('Z')]      = el_ring_bell,
+    [CTL('[')]      = meta,
+    [CTL(']')]      = move_to_char,
+    [CTL('^')]      = el_ring_bell,
+    [CTL('_')]      = el_ring_bell,
 };
 
-static el_keymap_t   MetaMap[64]= {
-    {   CTL('H'),       bk_kill_word    },
-    {   DEL,            bk_kill_word    },
-    {   ' ',            mk_set          },
-    {   '.',            last_argument   },
-    {   '<',            h_first         },
-    {   '>',            h_last          },
-    {   '?',            c_possible      },
-    {   'b',            bk_word         },
-    {   'c',            case_cap_word   },
-    {   'd',            fd_kill_word    },
-    {   'f',            fd_word         },
-    {   'l',            case_down_word  },
-    {   'm',            toggle_meta_mode },
-    {   'u',            case_up_word    },
-    {   'y',            yank            },
-    {   'w',            copy_region     },
-    {   0,              NULL            }
+static el_keymap_func_t *DefaultMetaMap[256] = {
+    [CTL('H')]      = bk_kill_word,
+    [DEL]           = bk_kill_word,
+    [' ']           = mk_set,
+    ['.']           = last_argument,
+    ['<']           = h_first,
+    ['>']           = h_last,
+    ['?']           = c_possible,
+    ['b']           = bk_word,
+    ['c']           = case_cap_word,
+    ['d']           = fd_kill_word,
+    ['f']           = fd_word,
+    ['l']           = case_down_word,
+    ['m']           = toggle_meta_mode,
+    ['u']           = case_up_word,
+    ['y']           = yank,
+    ['w']           = copy_region,
 };
 
-static size_t find_key_in_map(int key, el_keymap_t map[], size_t mapsz)
+/* The key is a byte, as returned by rl_getc(), NULL function unbinds */
+static el_status_t el_bind_key_in_map(int key, el_keymap_func_t function, el_keymap_func_t *map[])
 {
-    size_t i;
-
-    for (i = 0; i < mapsz && map[i].Function; i++) {
-        if (map[i].Key == key)
-            return i;
+    if (key < SCHAR_MIN || key > UCHAR_MAX) {
+        errno = EINVAL;
+        return CSeof;
     }
 
-    if (i < mapsz)
-        return i;
+    map[(unsigned char)key] = function;
 
-    return mapsz;
+    return CSdone;
 }
 
-static el_status_t el_bind_key_in_map(int key, el_keymap_func_t function, el_keymap_t map[], size_t mapsz)
+el_status_t el_bind_key(int key, el_keymap_func_t function)
 {
-    size_t creat, pos = find_key_in_map(key, map, mapsz);
+    return el_bind_key_in_map(key, function, Map);
+}
 
-    /* Must check that pos is not the next to last array position,
-     * otherwise we will write out-of-bounds to terminate the list. */
-    if (pos + 1 >= mapsz) {
-        errno = ENOMEM;
-        return CSeof;
-    }
+el_status_t el_bind_key_in_metamap(int key, el_keymap_func_t function)
+{
+    return el_bind_key_in_map(key, function, MetaMap);
+}
 
-    /* Add at end, create new? */
-    creat = map[pos].Function == NULL;
+/* Threads started after this get the key sequences of the default
+ * session, see DefaultSeq */
+static el_status_t seq_share(void)
+{
+#ifdef EL_THREAD_LOCAL
+    el_seqnode_t *p;
 
-    /* A new key so have to add it to end */
-    map[pos].Key      = key;
-    map[pos].Function = function;
+    if (el_cur != &el_default)
+        return CSdone;
 
-    /* Terminate list */
-    if (creat) {
-        map[pos + 1].Key      = 0;
-        map[pos + 1].Function = NULL;
-    }
+    p = el_malloc(sizeof(el_seqnode_t) * SeqSize);
+    if (!p)
+        return CSeof;
+    memcpy(p, Seq, sizeof(el_seqnode_t) * SeqLen);
+
+    el_free(DefaultSeq);
+    DefaultSeq     = p;
+    DefaultSeqLen  = SeqLen;
+    DefaultSeqSize = SeqSize;
+#endif
 
     return CSdone;
 }
 
-el_status_t el_bind_key(int key, el_keymap_func_t function)
+/* Bind a sequence of keys, e.g. "\030\023" for C-x C-s, or "\e[15~" for
+ * F5, NULL function unbinds.  A single key is bound in Map[]. */
+el_status_t el_bind_keyseq(const char *seq, el_keymap_func_t function)
 {
-    return el_bind_key_in_map(key, function, Map, NELEMS(Map));
+    if (!seq || !seq[0]) {
+        errno = EINVAL;
+        return CSeof;
+    }
+
+    if (!seq[1])
+        return el_bind_key((unsigned char)seq[0], function);
+
+    if (seq_init())
+        return CSeof;
+    if (!function)
+        seq_del(0, seq);
+    else if (seq_add(seq, function) != CSdone)
+        return CSeof;
+
+    return seq_share();
 }
 
-el_status_t el_bind_key_in_metamap(int key, el_keymap_func_t function)
+/* Bind an escape sequence, e.g. "\e[15~" for F5, NULL function unbinds */
+el_status_t el_bind_escseq(const char *seq, el_keymap_func_t function)
 {
-    return el_bind_key_in_map(key, function, MetaMap, NELEMS(MetaMap));
+    if (!seq || seq[0] != '\e' || !seq[1]) {
+        errno = EINVAL;
+        return CSeof;
+    }
+
+    return el_bind_keyseq(seq, function);
 }
 
 rl_getc_func_t *rl_set_getc_func(rl_getc_func_t *func)
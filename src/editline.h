@@ -53,26 +53,42 @@
 #ifdef GWINSZ_IN_SYS_IOCTL
 # include <sys/ioctl.h>
 #endif
+#include <time.h>
 
+#include "../include/editline.h"
+
+#define SCREEN_COLS     80
+#define SCREEN_ROWS     24
 #define MEM_INC         64
 #define SCREEN_INC      256
+#define INPUT_SIZE      4096
 
 /* From The Practice of Programming, by Kernighan and Pike */
 #ifndef NELEMS
 #define NELEMS(array) (sizeof(array) / sizeof(array[0]))
 #endif
 
+#ifndef MIN
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#endif
+
 /*
 **  Variables and routines internal to this package.
 */
-extern int	rl_eof;
-extern int	rl_erase;
-extern int	rl_intr;
-extern int	rl_kill;
-extern int	rl_quit;
+extern EL_TLS int rl_eof;
+extern EL_TLS int rl_erase;
+extern EL_TLS int rl_intr;
+extern EL_TLS int rl_kill;
+extern EL_TLS int rl_quit;
 #ifdef CONFIG_SIGSTOP
-extern int	rl_susp;
+extern EL_TLS int rl_susp;
 #endif
+extern EL_TLS const char *rl_prompt;
+void *el_calloc(size_t nmemb, size_t size);
+void *el_realloc(void *ptr, size_t size);
 void  rl_ttyset(int Reset);
 void  rl_add_slash(char *path, char *p);
 char *rl_complete(char *token, int *match);
@@ -98,5 +114,161 @@ extern int	strncmp(const char *s1, const char *s2, size_t n);
 extern char	*strdup(const char *s);
 #endif
 
-#include "../include/editline.h"
+/*
+**  Command history structure.
+*/
+typedef struct {
+    int         Size;
+    int         Pos;
+    char      **Lines;
+} el_hist_t;
+
+/* A block of per-line scratch memory, see arena_alloc() */
+typedef struct el_chunk {
+    struct el_chunk  *next;
+    size_t            size;
+    size_t            used;
+    char              data[];
+} el_chunk_t;
+
+/* A node of the key sequence trie, see seq_add() */
+typedef struct {
+    el_keymap_func_t *Function;
+    unsigned short    Kids;
+    unsigned short    Next[256];
+} el_seqnode_t;
+
+/* Decoder state, kept across calls in callback mode */
+typedef struct {
+    int             Active;     /* Sequence started, not complete */
+    int             Csi;        /* Skipping the rest of an unknown CSI */
+    int             First;      /* First key of the sequence */
+    int             Lead;       /* First byte after ESC, '[' for CSI */
+    int             Depth;      /* Keys read so far */
+    size_t          Node;       /* Position in Seq[] */
+    int             Meta;       /* Lone ESC timed out, next key is Meta */
+    struct timespec Deadline;   /* When to give up waiting, callback mode */
+} el_keyseq_t;
+
+/* A message from el_session_post(), queued for the editing thread */
+typedef struct el_msg {
+    struct el_msg    *next;
+    char              text[];
+} el_msg_t;
+
+/*
+**  An editing session: a terminal, its line, history and keymaps.  The
+**  library works on el_cur, the rl_* variables hold its line while it
+**  is current and are kept in Vars while it is not.
+*/
+struct el_session {
+    el_hist_t         H;
+    const char       *el_input;
+    char             *Yanked;
+    el_chunk_t       *Arena;          /* scratch memory of the line */
+    char             *Screen;         /* output buffer */
+    size_t            ScreenCount;
+    size_t            ScreenSize;
+    int               out_held;       /* written by el_loop_run(), io_uring */
+    const char       *el_term;
+    int               Repeat;
+    int               old_point;
+    int               el_push_back;
+    int               el_pushed;
+    int               el_intr_pending;
+    int               el_infd;
+    int               el_outfd;
+    int               out_sock;       /* el_outfd is a socket, see tty_write() */
+    char              Input[INPUT_SIZE];
+    int               input_fd;       /* fd the buffered input came from */
+    int               input_len;
+    int               input_pos;
+    int               input_eof;      /* read() hit end of file, or failed */
+    const char       *feed;           /* rl_callback_read_chars() input */
+    size_t            feed_len;
+    size_t            feed_pos;
+    el_keymap_func_t **Map;           /* direct-indexed by key */
+    el_keymap_func_t **MetaMap;
+    el_seqnode_t     *Seq;            /* key sequence trie, node 0 is the root */
+    size_t            SeqLen;
+    size_t            SeqSize;
+    el_keyseq_t       Keyseq;
+    el_status_t     (*Resume)(int c); /* command waiting for a key, callback mode */
+    size_t            Length;         /* size of rl_line_buffer */
+    char             *backspace;
+    char             *old_search;
+    int               tty_cols;
+    int               tty_rows;
+    int               Searching;
+    const char     *(*search_move)(void);
+    const char       *old_prompt;
+    const char       *rl_saved_prompt;
+    rl_vcpfunc_t     *line_handler;
+    /* Used as a display-column proxy in the wrap math: exact only for a
+     * printable single-width prompt.  A multibyte or escape-bearing prompt
+     * needs a real width (see RL_PROMPT_START/END_IGNORE, issue #48). */
+    int               prompt_len;
+
+    /* Screen model for the damage-tracking renderer: what the terminal shows
+     * of the current line, and where its cursor is.  Columns count display
+     * cells from the start of the prompt, so row = col / tty_cols.  When the
+     * last drawn cell filled a row the terminal defers the wrap: the cursor
+     * stays in the last column and cursor_wrap is set. */
+    char             *Shown;
+    size_t            ShownSize;
+    int               shown_end;      /* bytes of the line on screen */
+    int               shown_cols;     /* columns on screen, prompt included */
+    int               shown_meta;     /* rl_meta_chars when Shown was drawn */
+    int               prompt_shown;
+    int               cursor_col;
+    int               cursor_wrap;
+    int               shown_stale;    /* screen moved under the model */
+    int              *ColIndex;       /* columns of Shown[0 .. n * COL_BLOCK) */
+    size_t            ColIndexSize;
+    size_t            col_valid;      /* entries of ColIndex up to date */
+    int               tty_can_edit;   /* terminal has ICH, DCH, EL and ED */
+    char             *tc_area;        /* termcap strings, see rl_reset_terminal() */
+    char             *tc_ich;         /* IC, DC, ce and cd, NULL for ECMA-48 */
+    char             *tc_dch;
+    char             *tc_el;
+    char             *tc_ed;
+    int               paste_mode;     /* bracketed paste enabled */
+    char             *Paste;          /* paste read so far, see paste() */
+    size_t            PasteLen;
+    size_t            PasteSize;
+
+    el_msg_t         *Msgs;           /* posted, newest first, lock-free */
+    int               msg_fd[2];      /* wakes the editing thread, or -1 */
+
+    void             *tty_save;       /* terminal settings, see sysunix.c */
+
+    struct el_fncomp {                /* rl_filename_completion_function() */
+        char        **av, *dir, *file;
+        size_t        i, ac;
+    } Fncomp;
+
+    struct {                          /* rl_* variables, while not current */
+        int           point, mark, end;
+        char         *line_buffer;
+        const char   *prompt;
+        int           eof, erase, intr, kill, quit, susp;
+        int           meta_chars;
+    } Vars;
+
+    void             *data;           /* el_session_set_data() */
+};
+
+/* Per thread the current session cannot start out as &el_default, which
+ * is not a constant there, so NULL stands for it */
+#ifdef EL_THREAD_LOCAL
+extern EL_TLS el_session_t  el_default;
+extern EL_TLS el_session_t *el_cur_tls;
+#define el_cur          (el_cur_tls ? el_cur_tls : &el_default)
+#define el_set_cur(s)   (el_cur_tls = (s))
+#else
+extern el_session_t  el_default;
+extern el_session_t *el_cur;
+#define el_set_cur(s)   (el_cur = (s))
+#endif
+
 #endif  /* EDITLINE_PRIVATE_H_ */
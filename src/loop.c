@@ -0,0 +1,881 @@
+/* Multi-session event loop for editline library.
+ *
+ * Copyright (c) 1992, 1993  Simmule Turner and Rich Salz
+ * All rights reserved.
+ *
+ * This software is not subject to any license of the American Telephone
+ * and Telegraph Company or of the Regents of the University of California.
+ *
+ * Permission is granted to anyone to use this software for any purpose on
+ * any computer system, and to alter it and redistribute it freely, subject
+ * to the following restrictions:
+ * 1. The authors are not responsible for the consequences of use of this
+ *    software, no matter how awful, even if they arise from flaws in it.
+ * 2. The origin of this software must not be misrepresented, either by
+ *    explicit claim or by omission.  Since few users ever read sources,
+ *    credits must appear in the documentation.
+ * 3. Altered versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.  Since few users
+ *    ever read sources, credits must appear in the documentation.
+ * 4. This notice may not be removed or altered.
+ */
+
+#include <errno.h>
+#include "editline.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#ifdef CONFIG_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#endif
+
+#define LOOP_EVENTS     64
+#define URING_ENTRIES   256
+
+/*
+**  The loop drives any number of sessions in callback mode from one
+**  thread.  Each session has a watch on its input fd, and one on its
+**  output fd if that is another fd.  Input is read a buffer at a time
+**  and fed to rl_callback_read_chars(), output the terminal cannot take
+**  yet is written when epoll says the fd is writable.  A hangup of the
+**  output fd ends the session like end of file on its input.
+**
+**  With io_uring, each session instead always has a read queued, or a
+**  poll for input while its fd is non-blocking, and
+**  its output is held in Screen and handed to the ring, one write in
+**  flight at a time, a separate output fd polled for hangup.  All of it
+**  is submitted, and completions waited for, with one system call per
+**  el_loop_run().  Output to a socket uses MSG_NOSIGNAL, a pipe whose
+**  reader is gone raises SIGPIPE, which the application must ignore.
+*/
+typedef struct el_member el_member_t;
+
+typedef struct {
+    el_member_t  *m;
+    int           fd;
+    unsigned int  base;         /* EPOLLIN on the input fd */
+    unsigned int  events;       /* as registered with epoll */
+} el_watch_t;
+
+struct el_member {
+    el_session_t *s;
+    rl_vcpfunc_t *handler;
+    el_watch_t    in;
+    el_watch_t    out;          /* fd -1 if the same as in */
+    int           dead;         /* removed while el_loop_run() runs */
+    el_member_t  *next;
+    el_member_t  *gone;         /* next on the dead list */
+#ifdef CONFIG_IO_URING
+    int           ops;          /* requests in flight, freed when 0 */
+    int           reading;      /* OP_READ or OP_POLL in flight */
+    int           watching;     /* separate out fd, polled for hangup */
+    int           writing;
+    int           hangup;       /* drop output */
+    char         *ibuf;         /* INPUT_SIZE */
+    char         *obuf;         /* being written, swapped with Screen */
+    size_t        osize;
+    size_t        olen;
+    size_t        odone;
+    char         *rest;         /* output left at el_loop_del() */
+    size_t        rest_len;
+#endif
+};
+
+#ifdef CONFIG_IO_URING
+typedef struct {
+    int                  fd;
+    unsigned int         entries;
+    unsigned int        *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int        *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ring, *cq_ring;
+    size_t               sq_size, cq_size, sqes_size;
+} el_uring_t;
+
+/* Request type, in the low bits of the member address as user_data,
+ * which like any malloc() memory is at least 8 byte aligned */
+#define OP_READ         1
+#define OP_WRITE        2
+#define OP_CANCEL       3
+#define OP_HANGUP       4
+#define OP_POLL         5
+#define OP_MASK         7
+#endif
+
+struct el_loop {
+    int           epfd;
+    int           running;
+    el_member_t  *list;
+    el_member_t  *dead;         /* freed when idle, see loop_gc() */
+#ifdef CONFIG_IO_URING
+    el_uring_t   *ring;         /* NULL: epoll */
+#endif
+};
+
+static void member_eof(el_loop_t *loop, el_member_t *m, int hangup);
+
+#ifdef CONFIG_IO_URING
+static void *uring_map(el_uring_t *r, size_t size, off_t off)
+{
+    void *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, off);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    return p;
+}
+
+static void uring_free(el_uring_t *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_size);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_size);
+    close(r->fd);
+    el_free(r);
+}
+
+/* A ring, or NULL if the kernel has no io_uring, or one before Linux
+ * 5.11 that cannot time out a wait, and epoll is to be used. */
+static el_uring_t *uring_new(void)
+{
+    struct io_uring_params p;
+    el_uring_t *r;
+    char *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0)
+        return NULL;
+
+    r = el_calloc(1, sizeof(el_uring_t));
+    if (!r || !(p.features & IORING_FEAT_EXT_ARG)) {
+        el_free(r);
+        close(fd);
+        return NULL;
+    }
+
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = MAX(r->sq_size, r->cq_size);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = uring_map(r, r->sq_size, IORING_OFF_SQ_RING);
+    if (!r->sq_ring)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ring = r->sq_ring;
+    else
+        r->cq_ring = uring_map(r, r->cq_size, IORING_OFF_CQ_RING);
+    r->sqes = uring_map(r, r->sqes_size, IORING_OFF_SQES);
+    if (!r->cq_ring || !r->sqes)
+        goto fail;
+
+    sq = r->sq_ring;
+    cq = r->cq_ring;
+    r->sq_head  = (unsigned int *)(sq + p.sq_off.head);
+    r->sq_tail  = (unsigned int *)(sq + p.sq_off.tail);
+    r->sq_mask  = (unsigned int *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    r->cq_head  = (unsigned int *)(cq + p.cq_off.head);
+    r->cq_tail  = (unsigned int *)(cq + p.cq_off.tail);
+    r->cq_mask  = (unsigned int *)(cq + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return r;
+fail:
+    uring_free(r);
+    return NULL;
+}
+
+/* Submit what is queued and, if 'wait', wait up to 'timeout' ms, -1
+ * forever, for a completion. */
+static int uring_enter(el_uring_t *r, int wait, int timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int flags = IORING_ENTER_EXT_ARG;
+    unsigned int submit;
+
+    memset(&arg, 0, sizeof(arg));
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout >= 0) {
+            ts.tv_sec  = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+            arg.ts = (uintptr_t)&ts;
+        }
+    }
+
+    submit = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, r->fd, submit, wait ? 1 : 0, flags, &arg, sizeof(arg)) < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EBUSY)
+            return 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Queue a request for member 'm', submitted by the next uring_enter() */
+static int uring_push(el_loop_t *loop, el_member_t *m, int op, int fd, const void *addr, size_t len)
+{
+    el_uring_t *r = loop->ring;
+    struct io_uring_sqe *sqe;
+    unsigned int tail = *r->sq_tail, idx;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries) {
+        uring_enter(r, 0, 0);
+        if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries)
+            return -1;
+    }
+
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd   = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len  = len;
+    switch (op) {
+    case OP_READ:
+        sqe->opcode = IORING_OP_READ;
+        sqe->off = (uint64_t)-1;        /* current position, if any */
+        break;
+    case OP_WRITE:
+        if (m->s->out_sock) {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        }
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = (uint64_t)-1;
+        break;
+    case OP_CANCEL:
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        break;
+    case OP_HANGUP:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll_events = EPOLLERR | EPOLLHUP;
+        break;
+    case OP_POLL:
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll_events = EPOLLIN;
+        break;
+    }
+    sqe->user_data = (uintptr_t)m | op;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    m->ops++;
+
+    return 0;
+}
+
+static void uring_read(el_loop_t *loop, el_member_t *m)
+{
+    if (!uring_push(loop, m, OP_READ, m->in.fd, m->ibuf, INPUT_SIZE))
+        m->reading = OP_READ;
+}
+
+/* A read of a non-blocking fd fails at once with EAGAIN instead of
+ * waiting in the kernel, so wait for input with a poll first. */
+static void uring_poll(el_loop_t *loop, el_member_t *m)
+{
+    if (!uring_push(loop, m, OP_POLL, m->in.fd, NULL, 0))
+        m->reading = OP_POLL;
+}
+
+/* Output to another fd than input is only noticed to be gone when a
+ * write fails, unless polled for, e.g. an idle client's socket. */
+static void uring_watch(el_loop_t *loop, el_member_t *m)
+{
+    if (!uring_push(loop, m, OP_HANGUP, m->out.fd, NULL, 0))
+        m->watching = 1;
+}
+
+static void uring_write(el_loop_t *loop, el_member_t *m)
+{
+    int fd = m->out.fd >= 0 ? m->out.fd : m->in.fd;
+
+    if (m->hangup) {
+        m->olen = m->odone = 0;
+        return;
+    }
+
+    if (!uring_push(loop, m, OP_WRITE, fd, m->obuf + m->odone, m->olen - m->odone))
+        m->writing = 1;
+}
+
+/* Hand the output held in the session's Screen to the ring, swapping
+ * buffers instead of copying.  Screen keeps growing meanwhile. */
+static void uring_output(el_loop_t *loop, el_member_t *m)
+{
+    el_session_t *s = m->s;
+    char *buf = m->obuf;
+    size_t size = m->osize;
+
+    if (m->writing)
+        return;
+    if (m->olen) {
+        uring_write(loop, m);
+        return;
+    }
+    if (m->dead || !s->ScreenCount)
+        return;
+
+    m->obuf  = s->Screen;
+    m->osize = s->ScreenSize;
+    m->olen  = s->ScreenCount;
+    m->odone = 0;
+    s->Screen = buf;
+    s->ScreenSize = size;
+    s->ScreenCount = 0;
+
+    uring_write(loop, m);
+}
+
+static void uring_done(el_loop_t *loop, el_member_t *m, int op, int res)
+{
+    m->ops--;
+
+    switch (op) {
+    case OP_READ:
+        m->reading = 0;
+        if (m->dead || res == -EINTR)
+            break;
+        if (res == -EAGAIN) {
+            uring_poll(loop, m);
+            break;
+        }
+        if (res <= 0) {
+            member_eof(loop, m, 0);
+            break;
+        }
+        el_session_callback_read_chars(m->s, m->ibuf, res);
+        uring_output(loop, m);
+        break;
+
+    case OP_WRITE:
+        m->writing = 0;
+        if (res > 0) {
+            m->odone += res;
+        } else if (res != -EAGAIN && res != -EINTR) {
+            m->odone = m->olen;         /* e.g. hangup, the rest is lost */
+            if (!m->dead)
+                member_eof(loop, m, 1);
+        }
+
+        if (m->odone < m->olen) {
+            uring_write(loop, m);
+            break;
+        }
+        m->olen = m->odone = 0;
+
+        if (m->dead && m->rest) {
+            el_free(m->obuf);
+            m->obuf  = m->rest;
+            m->osize = m->olen = m->rest_len;
+            m->rest  = NULL;
+            uring_write(loop, m);
+        }
+        break;
+
+    case OP_POLL:
+        m->reading = 0;
+        if (!m->dead)
+            uring_read(loop, m);
+        break;
+
+    case OP_HANGUP:
+        m->watching = 0;
+        if (!m->dead)
+            member_eof(loop, m, 1);
+        break;
+    }
+}
+
+static int uring_reap(el_loop_t *loop)
+{
+    el_uring_t *r = loop->ring;
+    unsigned int head = *r->cq_head;
+    int n = 0;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+
+        __atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+        uring_done(loop, (el_member_t *)(uintptr_t)(data & ~(uint64_t)OP_MASK), data & OP_MASK, res);
+        n++;
+    }
+
+    return n;
+}
+
+/* At el_loop_del(): cancel the read, and keep the output the session
+ * has left, it is written before the member is freed. */
+static void uring_del(el_loop_t *loop, el_member_t *m)
+{
+    el_session_t *s = m->s;
+
+    if (m->reading)
+        uring_push(loop, m, OP_CANCEL, -1, (void *)((uintptr_t)m | m->reading), 0);
+    if (m->watching)
+        uring_push(loop, m, OP_CANCEL, -1, (void *)((uintptr_t)m | OP_HANGUP), 0);
+
+    if (s->ScreenCount) {
+        if (!m->writing && !m->olen) {
+            uring_output(loop, m);
+        } else {
+            m->rest = el_malloc(s->ScreenCount);
+            if (m->rest) {
+                memcpy(m->rest, s->Screen, s->ScreenCount);
+                m->rest_len = s->ScreenCount;
+            }
+            s->ScreenCount = 0;
+        }
+    }
+    s->out_held = 0;
+}
+#endif /* CONFIG_IO_URING */
+
+static int watch_add(el_loop_t *loop, el_watch_t *w)
+{
+    struct epoll_event ev = { .events = w->base, .data.ptr = w };
+
+    w->events = w->base;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, w->fd, &ev);
+}
+
+static void watch_set(el_loop_t *loop, el_watch_t *w, unsigned int events)
+{
+    struct epoll_event ev = { .events = w->base | events, .data.ptr = w };
+
+    if (ev.events == w->events)
+        return;
+
+    if (!epoll_ctl(loop->epfd, EPOLL_CTL_MOD, w->fd, &ev))
+        w->events = ev.events;
+}
+
+static void nonblock(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags != -1 && !(flags & O_NONBLOCK))
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int member_busy(el_member_t *m)
+{
+#ifdef CONFIG_IO_URING
+    return m->ops > 0;
+#else
+    (void)m;
+    return 0;
+#endif
+}
+
+static void member_free(el_member_t *m)
+{
+#ifdef CONFIG_IO_URING
+    el_free(m->ibuf);
+    el_free(m->obuf);
+    el_free(m->rest);
+#endif
+    el_free(m);
+}
+
+/* Free the removed members the kernel is done with */
+static void loop_gc(el_loop_t *loop)
+{
+    el_member_t **pp = &loop->dead, *m;
+
+    while ((m = *pp)) {
+        if (member_busy(m)) {
+            pp = &m->gone;
+            continue;
+        }
+        *pp = m->gone;
+        member_free(m);
+    }
+}
+
+/* Write what the terminal takes of the session's output, and watch for
+ * the fd to become writable while there is more. */
+static void member_flush(el_loop_t *loop, el_member_t *m)
+{
+    el_session_t *prev;
+    size_t left;
+
+    if (m->dead)
+        return;
+
+#ifdef CONFIG_IO_URING
+    if (loop->ring) {
+        uring_output(loop, m);
+        return;
+    }
+#endif
+
+    prev = el_session_set(m->s);
+    left = rl_output_pending();
+    el_session_set(prev);
+
+    watch_set(loop, m->out.fd >= 0 ? &m->out : &m->in, left ? EPOLLOUT : 0);
+}
+
+/* End of file, a read error, or with 'hangup' the output fd gone: the
+ * line handler gets NULL, as it does from rl_callback_read_char(), and
+ * the session leaves the loop. */
+static void member_eof(el_loop_t *loop, el_member_t *m, int hangup)
+{
+    el_session_t *prev, *s = m->s;
+
+    /* Nothing more can be written, a pipe would raise SIGPIPE */
+    if (hangup || m->out.fd < 0) {
+        s->el_outfd = -1;
+#ifdef CONFIG_IO_URING
+        m->hangup = 1;
+#endif
+    }
+    el_loop_del(loop, s);
+
+    /* The handler may free the session */
+    prev = el_session_set(s);
+    m->handler(NULL);
+    el_session_set(prev == s ? NULL : prev);
+}
+
+static void member_read(el_loop_t *loop, el_member_t *m)
+{
+    char buf[INPUT_SIZE];
+    ssize_t len;
+
+    if (m->dead)
+        return;
+
+    len = read(m->in.fd, buf, sizeof(buf));
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return;
+        member_eof(loop, m, 0);
+        return;
+    }
+    if (len == 0) {
+        member_eof(loop, m, 0);
+        return;
+    }
+
+    el_session_callback_read_chars(m->s, buf, len);
+}
+
+/* Handle sessions whose escape sequence has timed out */
+static void loop_timeouts(el_loop_t *loop)
+{
+    el_member_t *m;
+
+    for (m = loop->list; m; m = m->next) {
+        if (!m->dead && el_session_callback_timeout(m->s) == 0) {
+            el_session_callback_read_chars(m->s, NULL, 0);
+            member_flush(loop, m);
+        }
+    }
+}
+
+#ifdef CONFIG_IO_URING
+static int uring_run(el_loop_t *loop, int timeout)
+{
+    el_member_t *m;
+    int n;
+
+    for (m = loop->list; m; m = m->next) {
+        if (!m->reading)
+            uring_read(loop, m);
+        if (m->out.fd >= 0 && !m->watching)
+            uring_watch(loop, m);
+        uring_output(loop, m);
+    }
+
+    if (uring_enter(loop->ring, 1, timeout))
+        return -1;
+
+    loop->running = 1;
+    n = uring_reap(loop);
+    loop_timeouts(loop);
+    loop->running = 0;
+    loop_gc(loop);
+
+    return n;
+}
+#endif
+
+/* A loop on io_uring, if enabled at build time and the kernel has it,
+ * otherwise on epoll. */
+el_loop_t *el_loop_new(void)
+{
+    el_loop_t *loop;
+
+    loop = el_calloc(1, sizeof(el_loop_t));
+    if (!loop)
+        return NULL;
+
+#ifdef CONFIG_IO_URING
+    loop->epfd = -1;
+    loop->ring = uring_new();
+    if (loop->ring)
+        return loop;
+#endif
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        el_free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+/* Remove all sessions from the loop, the sessions themselves stay */
+void el_loop_free(el_loop_t *loop)
+{
+    if (!loop)
+        return;
+
+    while (loop->list)
+        el_loop_del(loop, loop->list->s);
+
+#ifdef CONFIG_IO_URING
+    if (loop->ring) {
+        /* Wait for the kernel to let go of the buffers */
+        while (loop->dead) {
+            loop_gc(loop);
+            if (!loop->dead || uring_enter(loop->ring, 1, -1))
+                break;
+            uring_reap(loop);
+        }
+        uring_free(loop->ring);
+    }
+#endif
+    loop_gc(loop);
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+    el_free(loop);
+}
+
+/* Add a session, made non-blocking, and install its line handler, which
+ * is called with the session current. */
+int el_loop_add(el_loop_t *loop, el_session_t *s, const char *prompt, rl_vcpfunc_t *lhandler)
+{
+    el_member_t *m;
+
+    if (!loop || !s || !lhandler) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    m = el_calloc(1, sizeof(el_member_t));
+    if (!m)
+        return -1;
+
+    m->s = s;
+    m->handler = lhandler;
+    m->in.m = m->out.m = m;
+    m->in.fd = s->el_infd;
+    m->in.base = EPOLLIN;
+    m->out.fd = s->el_outfd != s->el_infd ? s->el_outfd : -1;
+
+#ifdef CONFIG_IO_URING
+    if (loop->ring) {
+        /* Reads wait in the kernel, the fds stay as they are */
+        m->ibuf = el_malloc(INPUT_SIZE);
+        m->obuf = el_malloc(SCREEN_INC);
+        if (!m->ibuf || !m->obuf) {
+            member_free(m);
+            return -1;
+        }
+        m->osize = SCREEN_INC;
+        s->out_held = 1;
+        goto done;
+    }
+#endif
+
+    nonblock(m->in.fd);
+    if (watch_add(loop, &m->in))
+        goto fail;
+    if (m->out.fd >= 0) {
+        nonblock(m->out.fd);
+        if (watch_add(loop, &m->out)) {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, m->in.fd, NULL);
+            goto fail;
+        }
+    }
+#ifdef CONFIG_IO_URING
+done:
+#endif
+    m->next = loop->list;
+    loop->list = m;
+
+    el_session_callback_handler_install(s, prompt, lhandler);
+    member_flush(loop, m);
+
+    return 0;
+fail:
+    member_free(m);
+    return -1;
+}
+
+/* Remove a session from the loop, restoring its terminal.  Safe to call
+ * from its line handler. */
+int el_loop_del(el_loop_t *loop, el_session_t *s)
+{
+    el_member_t **pp, *m;
+
+    if (!loop || !s) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (pp = &loop->list; (m = *pp); pp = &m->next) {
+        if (m->s == s)
+            break;
+    }
+    if (!m) {
+        errno = ENOENT;
+        return -1;
+    }
+    *pp = m->next;
+
+#ifdef CONFIG_IO_URING
+    if (loop->ring) {
+        el_session_callback_handler_remove(s);
+        uring_del(loop, m);
+    } else
+#endif
+    {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, m->in.fd, NULL);
+        if (m->out.fd >= 0)
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, m->out.fd, NULL);
+        el_session_callback_handler_remove(s);
+    }
+
+    /* Keep m->next, el_loop_run() may be walking the list */
+    m->dead = 1;
+    m->gone = loop->dead;
+    loop->dead = m;
+    if (!loop->running)
+        loop_gc(loop);
+
+    return 0;
+}
+
+/*
+**  Wait up to 'timeout' ms, -1 forever, for any session to have input or
+**  take output, or for an escape sequence to time out, and handle it.
+**  Returns the number of events handled, 0 on timeout, or -1 on error.
+*/
+int el_loop_run(el_loop_t *loop, int timeout)
+{
+    struct epoll_event ev[LOOP_EVENTS];
+    el_member_t *m;
+    int i, n, ms;
+
+    if (!loop) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (m = loop->list; m; m = m->next) {
+        ms = el_session_callback_timeout(m->s);
+        if (ms >= 0 && (timeout < 0 || ms < timeout))
+            timeout = ms;
+    }
+
+#ifdef CONFIG_IO_URING
+    if (loop->ring)
+        return uring_run(loop, timeout);
+#endif
+
+    n = epoll_wait(loop->epfd, ev, NELEMS(ev), timeout);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    loop->running = 1;
+    for (i = 0; i < n; i++) {
+        el_watch_t *w = ev[i].data.ptr;
+
+        m = w->m;
+        if (w == &m->in && (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            member_read(loop, m);
+        else if (w == &m->out && !m->dead && (ev[i].events & (EPOLLHUP | EPOLLERR)))
+            member_eof(loop, m, 1);
+        member_flush(loop, m);
+    }
+    loop_timeouts(loop);
+    loop->running = 0;
+    loop_gc(loop);
+
+    return n;
+}
+
+#else  /* !HAVE_SYS_EPOLL_H */
+
+el_loop_t *el_loop_new(void)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void el_loop_free(el_loop_t *loop)
+{
+    (void)loop;
+}
+
+int el_loop_add(el_loop_t *loop, el_session_t *s, const char *prompt, rl_vcpfunc_t *lhandler)
+{
+    (void)loop;
+    (void)s;
+    (void)prompt;
+    (void)lhandler;
+    errno = ENOSYS;
+    return -1;
+}
+
+int el_loop_del(el_loop_t *loop, el_session_t *s)
+{
+    (void)loop;
+    (void)s;
+    errno = ENOSYS;
+    return -1;
+}
+
+int el_loop_run(el_loop_t *loop, int timeout)
+{
+    (void)loop;
+    (void)timeout;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/**
+ * Local Variables:
+ *  c-file-style: "k&r"
+ *  c-basic-offset: 4
+ * End:
+ */
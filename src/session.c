@@ -0,0 +1,347 @@
+/* Editing sessions for editline library.
+ *
+ * Copyright (c) 1992, 1993  Simmule Turner and Rich Salz
+ * All rights reserved.
+ *
+ * This software is not subject to any license of the American Telephone
+ * and Telegraph Company or of the Regents of the University of California.
+ *
+ * Permission is granted to anyone to use this software for any purpose on
+ * any computer system, and to alter it and redistribute it freely, subject
+ * to the following restrictions:
+ * 1. The authors are not responsible for the consequences of use of this
+ *    software, no matter how awful, even if they arise from flaws in it.
+ * 2. The origin of this software must not be misrepresented, either by
+ *    explicit claim or by omission.  Since few users ever read sources,
+ *    credits must appear in the documentation.
+ * 3. Altered versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.  Since few users
+ *    ever read sources, credits must appear in the documentation.
+ * 4. This notice may not be removed or altered.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include "editline.h"
+
+/*
+**  Each el_session_new() gets its own terminal, line, history and
+**  keymaps, the latter copied from the default session.  Settings like
+**  el_hist_size, el_no_echo and the completion functions are shared.
+*/
+
+static void session_save(el_session_t *s)
+{
+    s->Vars.point       = rl_point;
+    s->Vars.mark        = rl_mark;
+    s->Vars.end         = rl_end;
+    s->Vars.line_buffer = rl_line_buffer;
+    s->Vars.prompt      = rl_prompt;
+    s->Vars.meta_chars  = rl_meta_chars;
+    s->Vars.eof         = rl_eof;
+    s->Vars.erase       = rl_erase;
+    s->Vars.intr        = rl_intr;
+    s->Vars.kill        = rl_kill;
+    s->Vars.quit        = rl_quit;
+#ifdef CONFIG_SIGSTOP
+    s->Vars.susp        = rl_susp;
+#endif
+}
+
+static void session_load(el_session_t *s)
+{
+    rl_point       = s->Vars.point;
+    rl_mark        = s->Vars.mark;
+    rl_end         = s->Vars.end;
+    rl_line_buffer = s->Vars.line_buffer;
+    rl_prompt      = s->Vars.prompt;
+    rl_meta_chars  = s->Vars.meta_chars;
+    rl_eof         = s->Vars.eof;
+    rl_erase       = s->Vars.erase;
+    rl_intr        = s->Vars.intr;
+    rl_kill        = s->Vars.kill;
+    rl_quit        = s->Vars.quit;
+#ifdef CONFIG_SIGSTOP
+    rl_susp        = s->Vars.susp;
+#endif
+}
+
+/* Make 's', or the default session if NULL, the one the rl_* and el_*
+ * functions and variables work on.  Returns the previous session. */
+el_session_t *el_session_set(el_session_t *s)
+{
+    el_session_t *prev = el_cur;
+
+    if (!s)
+        s = &el_default;
+    if (s != prev) {
+        session_save(prev);
+        el_set_cur(s);
+        session_load(s);
+    }
+
+    return prev;
+}
+
+el_session_t *el_session_get(void)
+{
+    return el_cur;
+}
+
+/* Application data, e.g. the client a session's line handler serves */
+void el_session_set_data(el_session_t *s, void *data)
+{
+    s->data = data;
+}
+
+void *el_session_data(el_session_t *s)
+{
+    return s->data;
+}
+
+el_session_t *el_session_new(int infd, int outfd)
+{
+    el_session_t *def = &el_default;
+    el_session_t *s;
+
+    s = el_calloc(1, sizeof(el_session_t));
+    if (!s)
+        return NULL;
+
+    s->Map = el_malloc(sizeof(el_keymap_func_t *) * 256 * 2);
+    if (!s->Map) {
+        el_free(s);
+        return NULL;
+    }
+    s->MetaMap = s->Map + 256;
+    memcpy(s->Map, def->Map, sizeof(el_keymap_func_t *) * 256);
+    memcpy(s->MetaMap, def->MetaMap, sizeof(el_keymap_func_t *) * 256);
+
+    if (def->Seq) {
+        s->Seq = el_malloc(sizeof(el_seqnode_t) * def->SeqSize);
+        if (!s->Seq) {
+            el_free(s->Map);
+            el_free(s);
+            return NULL;
+        }
+        memcpy(s->Seq, def->Seq, sizeof(el_seqnode_t) * def->SeqLen);
+        s->SeqLen  = def->SeqLen;
+        s->SeqSize = def->SeqSize;
+    }
+
+    s->el_input  = "";
+    s->el_term   = "dumb";
+    s->el_infd   = infd;
+    s->el_outfd  = outfd;
+    s->input_fd  = -1;
+    s->backspace = "\b";
+    s->tty_cols  = SCREEN_COLS;
+    s->tty_rows  = SCREEN_ROWS;
+    s->msg_fd[0] = s->msg_fd[1] = -1;
+
+    return s;
+}
+
+/* Free a session from el_session_new(), restoring its terminal first if
+ * a callback handler is still installed.  The default session stays. */
+void el_session_free(el_session_t *s)
+{
+    el_session_t *prev;
+
+    if (!s || s == &el_default)
+        return;
+
+    prev = el_session_set(s);
+    rl_callback_handler_remove();
+    rl_uninitialize();
+    el_session_set(prev == s ? NULL : prev);
+
+    el_free(s->Map);
+    if (s->msg_fd[0] >= 0) {
+        close(s->msg_fd[0]);
+        close(s->msg_fd[1]);
+    }
+
+    while (s->Fncomp.ac > 0)
+        el_free(s->Fncomp.av[--s->Fncomp.ac]);
+    el_free(s->Fncomp.av);
+    el_free(s->Fncomp.dir);
+    el_free(s->Fncomp.file);
+    el_free(s);
+}
+
+char *el_session_readline(el_session_t *s, const char *prompt)
+{
+    el_session_t *prev = el_session_set(s);
+    char *line;
+
+    line = readline(prompt);
+    el_session_set(prev);
+
+    return line;
+}
+
+void el_session_callback_handler_install(el_session_t *s, const char *prompt, rl_vcpfunc_t *lhandler)
+{
+    el_session_t *prev = el_session_set(s);
+
+    rl_callback_handler_install(prompt, lhandler);
+    el_session_set(prev);
+}
+
+void el_session_callback_read_char(el_session_t *s)
+{
+    el_session_t *prev = el_session_set(s);
+
+    rl_callback_read_char();
+    el_session_set(prev);
+}
+
+void el_session_callback_read_chars(el_session_t *s, const char *buf, size_t len)
+{
+    el_session_t *prev = el_session_set(s);
+
+    rl_callback_read_chars(buf, len);
+    el_session_set(prev);
+}
+
+void el_session_callback_handler_remove(el_session_t *s)
+{
+    el_session_t *prev = el_session_set(s);
+
+    rl_callback_handler_remove();
+    el_session_set(prev);
+}
+
+int el_session_callback_timeout(el_session_t *s)
+{
+    el_session_t *prev = el_session_set(s);
+    int ms;
+
+    ms = el_callback_timeout();
+    el_session_set(prev);
+
+    return ms;
+}
+
+void el_session_add_history(el_session_t *s, const char *line)
+{
+    el_session_t *prev = el_session_set(s);
+
+    add_history(line);
+    el_session_set(prev);
+}
+
+int el_session_read_history(el_session_t *s, const char *filename)
+{
+    el_session_t *prev = el_session_set(s);
+    int rc;
+
+    rc = read_history(filename);
+    el_session_set(prev);
+
+    return rc;
+}
+
+int el_session_write_history(el_session_t *s, const char *filename)
+{
+    el_session_t *prev = el_session_set(s);
+    int rc;
+
+    rc = write_history(filename);
+    el_session_set(prev);
+
+    return rc;
+}
+
+/*
+**  Messages from other threads, printed above the line being edited.
+**  Posting pushes onto Msgs with a compare-and-swap, the editing thread
+**  takes the whole list with one exchange, see msg_show() in editline.c.
+**  Whoever finds the list empty wakes the editing thread.
+*/
+static void msg_wake(el_session_t *s)
+{
+    int fd = __atomic_load_n(&s->msg_fd[1], __ATOMIC_SEQ_CST);
+
+    if (fd < 0)
+        return;
+
+    /* The pipe is non-blocking, when full it is readable already */
+    while (write(fd, "", 1) < 0 && errno == EINTR)
+        ;
+}
+
+/* Queue a copy of 'msg' from any thread, for the session 's', NULL for
+ * the default, to print above its line: at the next key, the next line,
+ * or right away once el_session_message_fd() has been called.  With
+ * EL_THREAD_LOCAL every thread has its own default session, so NULL
+ * would not reach the editing thread and is refused. */
+int el_session_post(el_session_t *s, const char *msg)
+{
+    size_t len;
+    el_msg_t *m;
+
+    if (!msg) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!s) {
+#ifdef EL_THREAD_LOCAL
+        errno = EINVAL;
+        return -1;
+#else
+        s = &el_default;
+#endif
+    }
+
+    len = strlen(msg) + 1;
+    m = el_malloc(sizeof(el_msg_t) + len);
+    if (!m)
+        return -1;
+    memcpy(m->text, msg, len);
+
+    m->next = __atomic_load_n(&s->Msgs, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&s->Msgs, &m->next, m, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+    if (!m->next)
+        msg_wake(s);
+
+    return 0;
+}
+
+/* Called by the editing thread, returns an fd that is readable while
+ * messages wait.  From then on readline() shows them as they come, in
+ * callback mode poll it too and call rl_callback_read_char() then. */
+int el_session_message_fd(el_session_t *s)
+{
+    int fd[2], i;
+
+    if (!s)
+        s = &el_default;
+    if (s->msg_fd[0] >= 0)
+        return s->msg_fd[0];
+
+    if (pipe(fd))
+        return -1;
+    for (i = 0; i < 2; i++) {
+        fcntl(fd[i], F_SETFL, fcntl(fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    s->msg_fd[0] = fd[0];
+    __atomic_store_n(&s->msg_fd[1], fd[1], __ATOMIC_SEQ_CST);
+
+    /* Posted before there was anyone to wake */
+    if (__atomic_load_n(&s->Msgs, __ATOMIC_SEQ_CST))
+        msg_wake(s);
+
+    return fd[0];
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "k&r"
+ *  c-basic-offset: 4
+ * End:
+ */
@@ -23,6 +23,36 @@
 #include <errno.h>
 #include "editline.h"
 
+/* The saved terminal settings of the current session, see rl_ttyset() */
+static void *tty_saved(size_t size)
+{
+    if (!el_cur->tty_save)
+	el_cur->tty_save = el_calloc(1, size);
+
+    return el_cur->tty_save;
+}
+
+/* A pipe or socket, e.g. a telnet client, has no control chars of its
+ * own, so the usual ones apply */
+static void tty_defaults(void)
+{
+    rl_erase = 0x7f;
+    rl_kill  = 'U' & 0x1f;
+    rl_eof   = 'D' & 0x1f;
+    rl_intr  = 'C' & 0x1f;
+    rl_quit  = '\\' & 0x1f;
+#ifdef CONFIG_SIGSTOP
+    rl_susp  = 'Z' & 0x1f;
+#endif
+}
+
+/* A control char the terminal has disabled matches no key */
+#ifdef _POSIX_VDISABLE
+#define tty_cc(c)       ((c) == _POSIX_VDISABLE ? -1 : (c))
+#else
+#define tty_cc(c)       (c)
+#endif
+
 #ifndef HAVE_TCGETATTR
 /* Wrapper for ioctl syscalls to restart on signal */
 static int ioctl_wrap(int fd, int req, void *arg)
@@ -82,23 +112,32 @@ static int setattr(int fd, int opt, const struct termios *arg)
 
 void rl_ttyset(int Reset)
 {
-    static struct termios       old;
+    struct termios             *old = tty_saved(sizeof(*old));
     struct termios              new;
+    int                         fd = el_cur->el_infd;
+
+    if (!isatty(fd)) {
+	if (!Reset)
+	    tty_defaults();
+	return;
+    }
+    if (!old)
+	return;
 
     if (!Reset) {
-        if (-1 == getattr(0, &old))
+        if (-1 == getattr(fd, old))
 	    perror("Failed tcgetattr()");
 
-        rl_erase = old.c_cc[VERASE];
-        rl_kill = old.c_cc[VKILL];
-        rl_eof = old.c_cc[VEOF];
-        rl_intr = old.c_cc[VINTR];
-        rl_quit = old.c_cc[VQUIT];
+        rl_erase = tty_cc(old->c_cc[VERASE]);
+        rl_kill = tty_cc(old->c_cc[VKILL]);
+        rl_eof = tty_cc(old->c_cc[VEOF]);
+        rl_intr = tty_cc(old->c_cc[VINTR]);
+        rl_quit = tty_cc(old->c_cc[VQUIT]);
 #ifdef CONFIG_SIGSTOP
-        rl_susp = old.c_cc[VSUSP];
+        rl_susp = tty_cc(old->c_cc[VSUSP]);
 #endif
 
-        new = old;
+        new = *old;
         new.c_lflag &= ~(ECHO | ICANON | ISIG);
         new.c_iflag &= ~INPCK;
 	if (rl_meta_chars)
@@ -107,10 +146,10 @@ void rl_ttyset(int Reset)
 	    new.c_iflag &= ~ISTRIP;
         new.c_cc[VMIN] = 1;
         new.c_cc[VTIME] = 0;
-        if (-1 == setattr(0, TCSADRAIN, &new))
+        if (-1 == setattr(fd, TCSADRAIN, &new))
 	    perror("Failed tcsetattr(TCSADRAIN)");
     } else {
-        if (-1 == setattr(0, TCSADRAIN, &old))
+        if (-1 == setattr(fd, TCSADRAIN, old))
 	    perror("Failed tcsetattr(TCSADRAIN)");
     }
 }
@@ -120,23 +159,32 @@ void rl_ttyset(int Reset)
 
 void rl_ttyset(int Reset)
 {
-    static struct termio        old;
+    struct termio              *old = tty_saved(sizeof(*old));
     struct termio               new;
+    int                         fd = el_cur->el_infd;
+
+    if (!isatty(fd)) {
+	if (!Reset)
+	    tty_defaults();
+	return;
+    }
+    if (!old)
+	return;
 
     if (!Reset) {
-	if (-1 == ioctl_wrap(0, TCGETA, &old))
+	if (-1 == ioctl_wrap(fd, TCGETA, old))
 	    perror("Failed ioctl(TCGETA)");
 
-        rl_erase = old.c_cc[VERASE];
-        rl_kill = old.c_cc[VKILL];
-        rl_eof = old.c_cc[VEOF];
-        rl_intr = old.c_cc[VINTR];
-        rl_quit = old.c_cc[VQUIT];
+        rl_erase = tty_cc(old->c_cc[VERASE]);
+        rl_kill = tty_cc(old->c_cc[VKILL]);
+        rl_eof = tty_cc(old->c_cc[VEOF]);
+        rl_intr = tty_cc(old->c_cc[VINTR]);
+        rl_quit = tty_cc(old->c_cc[VQUIT]);
 #ifdef CONFIG_SIGSTOP
-        rl_susp = old.c_cc[VSUSP];
+        rl_susp = tty_cc(old->c_cc[VSUSP]);
 #endif
 
-        new = old;
+        new = *old;
         new.c_lflag &= ~(ECHO | ICANON | ISIG);
         new.c_iflag &= ~INPCK;
 	if (rl_meta_chars)
@@ -146,10 +194,10 @@ void rl_ttyset(int Reset)
 
         new.c_cc[VMIN] = 1;
         new.c_cc[VTIME] = 0;
-        if (-1 == ioctl_wrap(0, TCSETAW, &new))
+        if (-1 == ioctl_wrap(fd, TCSETAW, &new))
 	    perror("Failed ioctl(TCSETAW)");
     } else {
-	if (-1 == ioctl_wrap(0, TCSETAW, &old))
+	if (-1 == ioctl_wrap(fd, TCSETAW, old))
 	    perror("Failed ioctl(TCSETAW)");
     }
 }
@@ -157,38 +205,51 @@ void rl_ttyset(int Reset)
 #elif defined(HAVE_SGTTY_H)
 #include <sgtty.h>
 
+struct sgtty_save {
+    struct sgttyb               sgttyb;
+    struct tchars               tchars;
+};
+
 void rl_ttyset(int Reset)
 {
-    static struct sgttyb        old_sgttyb;
-    static struct tchars        old_tchars;
+    struct sgtty_save          *save = tty_saved(sizeof(*save));
     struct sgttyb               new_sgttyb;
     struct tchars               new_tchars;
 #ifdef CONFIG_SIGSTOP
     struct ltchars              old_ltchars;
 #endif
+    int                         fd = el_cur->el_infd;
+
+    if (!isatty(fd)) {
+	if (!Reset)
+	    tty_defaults();
+	return;
+    }
+    if (!save)
+	return;
 
     if (!Reset) {
-        if (-1 == ioctl_wrap(0, TIOCGETP, &old_sgttyb))
+        if (-1 == ioctl_wrap(fd, TIOCGETP, &save->sgttyb))
 	    perror("Failed TIOCGETP");
 
-        rl_erase = old_sgttyb.sg_erase;
-        rl_kill = old_sgttyb.sg_kill;
+        rl_erase = save->sgttyb.sg_erase;
+        rl_kill = save->sgttyb.sg_kill;
 
-        if (-1 == ioctl_wrap(0, TIOCGETC, &old_tchars))
+        if (-1 == ioctl_wrap(fd, TIOCGETC, &save->tchars))
 	    perror("Failed TIOCGETC");
 
-	rl_eof = old_tchars.t_eofc;
-        rl_intr = old_tchars.t_intrc;
-        rl_quit = old_tchars.t_quitc;
+	rl_eof = save->tchars.t_eofc;
+        rl_intr = save->tchars.t_intrc;
+        rl_quit = save->tchars.t_quitc;
 
 #ifdef CONFIG_SIGSTOP
-        if (-1 == ioctl_wrap(0, TIOCGLTC, &old_ltchars))
+        if (-1 == ioctl_wrap(fd, TIOCGLTC, &old_ltchars))
 	    perror("Failed TIOCGLTC");
 
 	rl_susp = old_ltchars.t_suspc;
 #endif
 
-        new_sgttyb = old_sgttyb;
+        new_sgttyb = save->sgttyb;
         new_sgttyb.sg_flags &= ~ECHO;
         new_sgttyb.sg_flags |= RAW;
 	if (rl_meta_chars)
@@ -196,19 +257,19 @@ void rl_ttyset(int Reset)
 	else
 	    new_sgttyb.sg_flags |= PASS8;
 
-	if (-1 == ioctl_wrap(0, TIOCSETP, &new_sgttyb))
+	if (-1 == ioctl_wrap(fd, TIOCSETP, &new_sgttyb))
 	    perror("Failed TIOCSETP");
 
-	new_tchars = old_tchars;
+	new_tchars = save->tchars;
         new_tchars.t_intrc = -1;
         new_tchars.t_quitc = -1;
-        if (-1 == ioctl_wrap(0, TIOCSETC, &new_tchars))
+        if (-1 == ioctl_wrap(fd, TIOCSETC, &new_tchars))
 	    perror("Failed TIOCSETC");
     } else {
-        if (-1 == ioctl_wrap(0, TIOCSETP, &old_sgttyb))
+        if (-1 == ioctl_wrap(fd, TIOCSETP, &save->sgttyb))
 	    perror("Failed TIOCSETP");
 
-	if (-1 == ioctl_wrap(0, TIOCSETC, &old_tchars))
+	if (-1 == ioctl_wrap(fd, TIOCSETC, &save->tchars))
 	    perror("Failed TIOCSETC");
     }
 }
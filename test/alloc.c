@@ -0,0 +1,181 @@
+/* Allocator: with el_set_allocator() every block the library takes must
+ * come from, and go back to, the given allocator.  Blocks carry a magic
+ * header, so one released with free() instead, or one from malloc()
+ * given to us, crashes.  After reading lines, completing a file name and
+ * adding history, nothing must be left once the session is freed. */
+#include <config.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "editline.h"
+
+#define MAGIC 0x5ea1ed
+
+typedef struct {
+	size_t size;
+	size_t magic;
+	max_align_t align[];
+} block_t;
+
+static size_t allocs, live, bad;
+
+static void *count_malloc(void *arg, size_t size)
+{
+	block_t *b;
+
+	(void)arg;
+	b = malloc(sizeof(*b) + size);
+	if (!b)
+		return NULL;
+
+	b->size = size;
+	b->magic = MAGIC;
+	allocs++;
+	live++;
+
+	return b->align;
+}
+
+static void count_free(void *arg, void *ptr)
+{
+	block_t *b;
+
+	(void)arg;
+	if (!ptr)
+		return;
+
+	b = (block_t *)ptr - 1;
+	if (b->magic != MAGIC) {
+		bad++;
+		return;
+	}
+
+	b->magic = 0;
+	live--;
+	free(b);
+}
+
+static void *count_realloc(void *arg, void *ptr, size_t size)
+{
+	block_t *b;
+	void *p;
+
+	if (!ptr)
+		return count_malloc(arg, size);
+
+	b = (block_t *)ptr - 1;
+	if (b->magic != MAGIC) {
+		bad++;
+		return NULL;
+	}
+
+	p = count_malloc(arg, size);
+	if (!p)
+		return NULL;
+	memcpy(p, ptr, b->size < size ? b->size : size);
+	count_free(arg, ptr);
+
+	return p;
+}
+
+static const el_allocator_t counter = {
+	.malloc_func  = count_malloc,
+	.realloc_func = count_realloc,
+	.free_func    = count_free,
+};
+
+static char *lines[4];
+static size_t count;
+
+static void handler(char *line)
+{
+	if (count < sizeof(lines) / sizeof(lines[0]))
+		lines[count++] = line;
+	else
+		el_free(line);
+}
+
+static int check(const char *name, const char *got, const char *expect)
+{
+	if (!got || strncmp(got, expect, strlen(expect))) {
+		fprintf(stderr, "FAIL %-20s expected [%s] got [%s]\n", name, expect, got ? got : "(null)");
+		return 1;
+	}
+
+	printf("PASS %-20s [%s]\n", name, got);
+	return 0;
+}
+
+int main(void)
+{
+	const el_allocator_t broken = { .malloc_func = count_malloc };
+	el_session_t *s;
+	char *line;
+	int fail = 0, tests = 0;
+	FILE *fp;
+	int fd;
+	size_t i;
+
+	tests++;
+	if (el_set_allocator(&broken) != -1 || el_set_allocator(&counter)) {
+		fprintf(stderr, "FAIL %-20s incomplete allocator accepted\n", "set-allocator");
+		return 1;
+	}
+	printf("PASS %-20s [incomplete allocator rejected]\n", "set-allocator");
+
+	fp = tmpfile();
+	fd = open("/dev/null", O_WRONLY);
+	if (!fp || fd < 0) {
+		perror("tmpfile");
+		return 77;
+	}
+	fprintf(fp, "first line\n");
+	fflush(fp);
+	rewind(fp);
+
+	s = el_session_new(fileno(fp), fd);
+	if (!s) {
+		perror("el_session_new");
+		return 1;
+	}
+
+	line = el_session_readline(s, "> ");
+	tests++;
+	fail += check("readline", line, "first line");
+	el_free(line);
+
+	/* Redirected input is now done, edit from here on */
+	el_session_callback_handler_install(s, "> ", handler);
+	el_session_callback_read_chars(s, "one two\r", 8);
+	el_session_callback_read_chars(s, "\033.\r", 3);
+	el_session_callback_read_chars(s, "Makefil\t\r", 9);
+	el_session_callback_handler_remove(s);
+
+	tests += 3;
+	fail += check("callback", lines[0], "one two");
+	fail += check("last-argument", lines[1], "two");
+	fail += check("complete", lines[2], "Makefile");
+
+	for (i = 0; i < count; i++)
+		el_free(lines[i]);
+	el_session_free(s);
+
+	tests++;
+	if (!allocs || live || bad) {
+		fprintf(stderr, "FAIL %-20s %zu allocations, %zu left, %zu foreign\n", "released",
+			allocs, live, bad);
+		fail++;
+	} else {
+		printf("PASS %-20s [%zu allocations, none left]\n", "released", allocs);
+	}
+
+	fclose(fp);
+	close(fd);
+
+	printf("\nalloc: %d tests, %d failures\n", tests, fail);
+	return fail ? 1 : 0;
+}
@@ -22,6 +22,13 @@ static char *comp_space(char *token, int *match)
 	return strdup("lo go");
 }
 
+/* Application key binding */
+static el_status_t key_tag(void)
+{
+	rl_insert_text("[key]");
+	return CSmove;
+}
+
 static const struct testcase cases[] = {
 	{ "insert",            "hello\r",                  "hello"        , NULL        },
 	{ "backspace",         "hellx\010o\r",             "hello"        , NULL        },
@@ -33,14 +40,35 @@ static const struct testcase cases[] = {
 	{ "transpose",         "ab\024\r",                 "ba"           , NULL        },
 #ifdef CONFIG_ANSI_ARROWS
 	{ "arrow-left",        "abc\033[D\033[DX\r",       "aXbc"         , NULL        },
+	{ "paste",             "ab\002\033[200~x\ry\t\033[201~\r",
+	                                                   "ax\ry\tb"     , NULL        },
+	{ "unknown-csi",       "ab\033[1;2P\033[24;5~c\r", "abc"          , NULL        },
+	{ "unknown-ss3",       "ab\033OPc\r",              "abc"          , NULL        },
+	{ "bind-escseq",       "ab\002\033[15~\r",         "a[key]b"      , NULL        },
 #endif
+	{ "bind-many",         "ab\033x\r",                "ab[key]"      , NULL        },
+	{ "bind-keyseq",       "ab\030\023c\r",           "ab[key]c"     , NULL        },
+	{ "keyseq-prefix",     "ab\030\030c\030q\r",       "cab"          , NULL        },
+	{ "keyseq-unbind",     "ab\001zc\r",               "zcab"         , NULL        },
 	{ "complete-plain",    "h\t\r",                    "hello"        , comp_plain  },
 	{ "complete-space",    "h\t\r",                    "hlo go"       , comp_space  },
 };
 
 int main(void)
 {
-	int rc = el_run_cases("basic", cases, sizeof(cases) / sizeof(cases[0]));
+	int rc, key;
+
+	/* More bindings than the old 64-entry keymaps could hold */
+	for (key = 0x80; key <= 0xff; key++)
+		el_bind_key_in_metamap(key, key_tag);
+	el_bind_key_in_metamap('x', key_tag);
+	el_bind_keyseq("\030\023", key_tag);
+	el_bind_keyseq("\001z", key_tag);	/* unbound, C-a is C-a again */
+	el_bind_keyseq("\001z", NULL);
+#ifdef CONFIG_ANSI_ARROWS
+	el_bind_escseq("\033[15~", key_tag);
+#endif
+	rc = el_run_cases("basic", cases, sizeof(cases) / sizeof(cases[0]));
 
 	if (rc < 0)
 		return 77;		/* SKIP: no pty */
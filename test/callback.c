@@ -0,0 +1,163 @@
+/* Callback interface fed from memory: rl_callback_read_chars() handles
+ * input the application read itself, a buffer at a time.  Lines and
+ * escape sequences split across buffers must come through whole, a
+ * lone ESC past el_esc_timeout still be Meta for the next key, and
+ * each completed line reach the handler.  Then, with el_callback_drain,
+ * one rl_callback_read_char() must handle all input waiting on el_infd,
+ * more than one read() gets, and the end of file after it, which the
+ * handler gets as NULL.  Last, on non-blocking fds, no input must
+ * not read as EOF, but a closed writer must, a command reading more
+ * keys must not wait for them, and output the terminal cannot take yet
+ * must be kept for rl_output_pending(). */
+#include <config.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "editline.h"
+
+static char  *lines[8];
+static size_t count;
+static int    eofs;
+static char   big[6000];
+static char   huge[100000];
+
+static void handler(char *line)
+{
+	if (!line)
+		eofs++;
+	else if (count < sizeof(lines) / sizeof(lines[0]))
+		lines[count++] = line;
+	else
+		free(line);
+}
+
+int main(void)
+{
+	const char *chunks[] = { "hel", "lo\rab", "c\033", "[D", "X\r", "\033[1", "5~y\r" };
+	const char *expect[] = { "hello", "abXc", "y", "Xab", big, "two", "q", huge };
+	size_t i, queued, got = 0;
+	int fail = 0;
+	int fd[2], in[2], out[2];
+	char buf[4096];
+	ssize_t r;
+
+	/* Keep the drawing out of the test log */
+	rl_outstream = fopen("/dev/null", "w");
+	el_no_hist = 1;
+
+	rl_callback_handler_install("", handler);
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+		rl_callback_read_chars(chunks[i], strlen(chunks[i]));
+
+	/* A lone ESC timed out still makes the next key Meta, here M-b */
+	el_esc_timeout = 0;
+	rl_callback_read_chars("ab\033", 3);
+	rl_callback_read_chars("bX\r", 3);
+	el_esc_timeout = 500;
+	rl_callback_handler_remove();
+
+	memset(big, 'x', sizeof(big) - 1);
+	if (pipe(fd)) {
+		perror("pipe");
+		return 77;
+	}
+	if (write(fd[1], big, strlen(big)) < 0 || write(fd[1], "\rtwo\r", 5) < 0) {
+		perror("write");
+		return 77;
+	}
+	close(fd[1]);
+	rl_instream = fdopen(fd[0], "r");
+	el_callback_drain = 1;
+
+	/* A drain that does not stop at end of file never returns */
+	alarm(5);
+	rl_callback_handler_install("", handler);
+	rl_callback_read_char();
+	rl_callback_handler_remove();
+	alarm(0);
+
+	if (eofs != 1) {
+		fprintf(stderr, "FAIL eof             handler got NULL %d times\n", eofs);
+		fail++;
+	} else {
+		printf("PASS eof             [after the lines]\n");
+	}
+	fclose(rl_instream);
+
+	memset(huge, 'y', sizeof(huge) - 1);
+	if (pipe(in) || pipe(out)) {
+		perror("pipe");
+		return 77;
+	}
+	fcntl(in[0], F_SETFL, O_NONBLOCK);
+	fcntl(out[0], F_SETFL, O_NONBLOCK);
+	fcntl(out[1], F_SETFL, O_NONBLOCK);
+	rl_instream = fdopen(in[0], "r");
+	rl_outstream = fdopen(out[1], "w");
+
+	rl_callback_handler_install("", handler);
+	rl_callback_read_char();	/* Nothing to read, must not be EOF */
+
+	/* Quote reads one more key, which must not be waited for */
+	alarm(5);
+	if (write(in[1], "\026", 1) != 1)
+		return 77;
+	rl_callback_read_char();
+	if (write(in[1], "q\r", 2) != 2)
+		return 77;
+	rl_callback_read_char();
+	alarm(0);
+
+	rl_callback_read_chars(huge, strlen(huge));
+	queued = rl_output_pending();
+	while (rl_output_pending()) {
+		r = read(out[0], buf, sizeof(buf));
+		if (r > 0)
+			got += r;
+	}
+	while ((r = read(out[0], buf, sizeof(buf))) > 0)
+		got += r;
+	rl_callback_read_chars("\r", 1);
+
+	/* Without drain too, a closed writer is end of file, not no input */
+	close(in[1]);
+	rl_callback_read_char();
+	rl_callback_handler_remove();
+
+	if (!queued || got < strlen(huge)) {
+		fprintf(stderr, "FAIL output-pending    queued %zu, got %zu bytes\n", queued, got);
+		fail++;
+	} else {
+		printf("PASS output-pending    [%zu bytes]\n", got);
+	}
+	if (eofs != 2) {
+		fprintf(stderr, "FAIL eof-nonblocking handler got NULL %d times\n", eofs - 1);
+		fail++;
+	} else {
+		printf("PASS eof-nonblocking [writer closed]\n");
+	}
+
+	for (i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+		const char *line = i < count ? lines[i] : NULL;
+
+		if (!line || strcmp(line, expect[i])) {
+			fprintf(stderr, "FAIL line-%-13zu expected [%s] got [%s]\n", i + 1,
+				expect[i], line ? line : "(null)");
+			fail++;
+		} else {
+			printf("PASS line-%-13zu [%s]\n", i + 1, line);
+		}
+	}
+	if (count != i) {
+		fprintf(stderr, "FAIL lines           expected %zu got %zu\n", i, count);
+		fail++;
+	}
+
+	for (i = 0; i < count; i++)
+		free(lines[i]);
+	printf("\ncallback: %zu tests, %d failures\n", sizeof(expect) / sizeof(expect[0]) + 3, fail);
+	return fail ? 1 : 0;
+}
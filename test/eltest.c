@@ -6,6 +6,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <termios.h>
 #include <sys/wait.h>
 
@@ -157,3 +158,64 @@ int el_capture(const char *input, int width, unsigned char *out, int outsz)
 	out[len] = 0;
 	return len;
 }
+
+/* Read from the pty until the editor has been quiet for a while. */
+static int drain(int master, unsigned char *out, int outsz)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	int len = 0;
+
+	pfd.fd = master;
+	pfd.events = POLLIN;
+	while (len < outsz - 1 && poll(&pfd, 1, 200) > 0) {
+		n = read(master, out + len, outsz - 1 - len);
+		if (n <= 0)
+			break;
+		len += (int)n;
+	}
+	out[len] = 0;
+
+	return len;
+}
+
+int el_capture_keys(const char *setup, const char *input, int width,
+		    unsigned char *out, int outsz)
+{
+	struct winsize ws;
+	int master, len;
+	pid_t pid;
+
+	memset(&ws, 0, sizeof(ws));
+	ws.ws_col = (unsigned short)width;
+	ws.ws_row = 24;
+
+	pid = spawn(&master, &ws);
+	if (pid < 0)
+		return -1;		/* SKIP: no pty */
+	if (pid == 0) {
+		char *line = readline("");
+
+		(void)line;
+		_exit(0);
+	}
+
+	if (write(master, setup, strlen(setup)) < 0)
+		perror("write");
+	drain(master, out, outsz);
+
+	if (write(master, input, strlen(input)) < 0)
+		perror("write");
+	len = drain(master, out, outsz);
+
+	/* Let the editor finish the line and exit. */
+	if (write(master, "\r", 1) < 0)
+		perror("write");
+	while (read(master, out + len, outsz - 1 - len) > 0)
+		;
+	out[len] = 0;
+	waitpid(pid, NULL, 0);
+	close(master);
+
+	return len;
+}
@@ -33,4 +33,12 @@ int el_run_cases(const char *suite, const struct testcase *cases, size_t count);
  */
 int el_capture(const char *input, int width, unsigned char *out, int outsz);
 
+/*
+ * Like el_capture(), but type `setup` first and wait for the editor to
+ * draw it, then type `input` and capture only the output that follows,
+ * up to when the editor idles.  The line is then ended with Enter.
+ */
+int el_capture_keys(const char *setup, const char *input, int width,
+		    unsigned char *out, int outsz);
+
 #endif /* ELTEST_H */
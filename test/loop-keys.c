@@ -0,0 +1,130 @@
+/* Event loop and commands that read more keys: with two sessions on
+ * socketpairs, a command waiting for its next key in one session, like
+ * quote, a Meta+digit repeat count or a bracketed paste without its end
+ * yet, must not hold up the other.  The command then completes with the
+ * keys when they arrive. */
+#include <config.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "editline.h"
+
+static const struct {
+	const char *name;
+	const char *first;	/* to session A, ends waiting for a key */
+	const char *rest;	/* the key, and the end of the line */
+	const char *expect;
+} cases[] = {
+	{ "quote",         "a\026",            "\002b\r",  "a\002b"       },
+	{ "exchange",      "ab\030",           "\030X\r",  "Xab"          },
+	{ "move-to-char",  "abcd\001\035",     "cX\r",     "abXcd"        },
+	{ "repeat-count",  "\0331",            "2x\r",     "xxxxxxxxxxxx" },
+	{ "paste",         "\033[200~a\rb\033[2", "01~c\r", "a\rbc"       },
+	{ "search",        "\022",             "Xa\r\r",   "Xab"          },
+};
+
+static char *lines[2];
+
+static void handler(char *line)
+{
+	int *n = el_session_data(el_session_get());
+
+	if (!line)
+		return;
+
+	free(lines[*n]);
+	lines[*n] = line;
+}
+
+static int type(int fd, const char *keys)
+{
+	if (write(fd, keys, strlen(keys)) < 0) {
+		perror("write");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void run(el_loop_t *loop)
+{
+	while (el_loop_run(loop, 100) > 0)
+		;
+}
+
+int main(void)
+{
+	el_session_t *sess[2];
+	el_loop_t *loop;
+	int fd[2][2], id[2] = { 0, 1 };
+	int fail = 0, i;
+	size_t n;
+
+	loop = el_loop_new();
+	if (!loop) {
+		if (errno == ENOSYS)
+			return 77;	/* SKIP: no epoll */
+		perror("el_loop_new");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd[i])) {
+			perror("socketpair");
+			return 77;
+		}
+		sess[i] = el_session_new(fd[i][1], fd[i][1]);
+		if (!sess[i] || el_loop_add(loop, sess[i], "> ", handler)) {
+			perror("el_loop_add");
+			return 1;
+		}
+		el_session_set_data(sess[i], &id[i]);
+	}
+
+	/* A blocked loop fails the test rather than hanging it */
+	alarm(10);
+
+	for (n = 0; n < sizeof(cases) / sizeof(cases[0]); n++) {
+		if (type(fd[0][0], cases[n].first))
+			return 1;
+		run(loop);
+
+		free(lines[1]);
+		lines[1] = NULL;
+		if (type(fd[1][0], "ok\r"))
+			return 1;
+		run(loop);
+
+		if (type(fd[0][0], cases[n].rest))
+			return 1;
+		run(loop);
+
+		if (!lines[1] || strcmp(lines[1], "ok")) {
+			fprintf(stderr, "FAIL %-20s other session held up\n", cases[n].name);
+			fail++;
+		} else if (!lines[0] || strcmp(lines[0], cases[n].expect)) {
+			fprintf(stderr, "FAIL %-20s expected [%s] got [%s]\n", cases[n].name,
+				cases[n].expect, lines[0] ? lines[0] : "(null)");
+			fail++;
+		} else {
+			printf("PASS %-20s [%s]\n", cases[n].name, lines[0]);
+		}
+	}
+	alarm(0);
+
+	el_loop_free(loop);
+	for (i = 0; i < 2; i++) {
+		free(lines[i]);
+		el_session_free(sess[i]);
+		close(fd[i][0]);
+		close(fd[i][1]);
+	}
+
+	printf("\nloop-keys: %zu tests, %d failures\n", n, fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,264 @@
+/* Event loop: several sessions on socketpairs, driven by el_loop_run()
+ * from one thread.  Input sent to each, split and interleaved, must
+ * come through as that session's lines, also from a non-blocking fd,
+ * with the session current in its line handler, and the echo must
+ * reach each client.  A client
+ * hanging up must give its handler NULL and leave the loop.  A handler
+ * removing its session from the loop, or freeing it too, must not get
+ * a new prompt, nor have the default session prepped instead.  Output
+ * fds hung up must not spin the loop, nor raise SIGPIPE. */
+#include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "editline.h"
+
+#define SESSIONS 3
+#define LOSERS   2	/* sessions whose client stops reading */
+
+static el_loop_t    *loop;
+static el_session_t *sess[SESSIONS + LOSERS];
+static char         *lines[SESSIONS + LOSERS];
+static int           eofs[SESSIONS + LOSERS];
+static int           wrong;
+
+static void handler(char *line)
+{
+	int *n = el_session_data(el_session_get());
+
+	if (!n || sess[*n] != el_session_get()) {
+		wrong++;
+		free(line);
+		return;
+	}
+
+	if (!line) {
+		eofs[*n]++;
+		return;
+	}
+
+	if (!strcmp(line, "quit") || !strcmp(line, "bye")) {
+		el_session_t *s = el_session_get();
+
+		el_loop_del(loop, s);
+		if (!strcmp(line, "bye")) {
+			el_session_free(s);
+			sess[*n] = NULL;
+		}
+	}
+
+	if (lines[*n])
+		free(lines[*n]);
+	lines[*n] = line;
+}
+
+static int drained(int fd, const char *expect)
+{
+	char buf[256];
+	ssize_t len;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	return strstr(buf, expect) != NULL;
+}
+
+/* The client got the echo of 'word', and no prompt after it */
+static int noprompt(int fd, const char *word)
+{
+	char buf[256], *p;
+	ssize_t len;
+
+	len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	p = strstr(buf, word);
+	return p && !strstr(p, "> ");
+}
+
+int main(void)
+{
+	const char *expect[SESSIONS] = { "alpha", "bravo", "charlie" };
+	int fd[SESSIONS + LOSERS][2], id[SESSIONS + LOSERS], out[2];
+	int i, round, fail = 0, tests = 0;
+	char name[32];
+
+	/* A loop spinning on a hung up, or non-blocking, fd never drains */
+	alarm(10);
+	loop = el_loop_new();
+	if (!loop) {
+		if (errno == ENOSYS)
+			return 77;	/* SKIP: no epoll */
+		perror("el_loop_new");
+		return 1;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd[i])) {
+			perror("socketpair");
+			return 77;
+		}
+		/* With io_uring a read of it cannot wait in the kernel */
+		if (i == 1)
+			fcntl(fd[i][1], F_SETFL, O_NONBLOCK);
+		sess[i] = el_session_new(fd[i][1], fd[i][1]);
+		id[i] = i;
+		el_session_set_data(sess[i], &id[i]);
+		if (!sess[i] || el_loop_add(loop, sess[i], "> ", handler)) {
+			perror("el_loop_add");
+			return 1;
+		}
+	}
+
+	/* Each client sends its word in two halves, interleaved */
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < SESSIONS; i++) {
+			size_t half = strlen(expect[i]) / 2;
+			const char *p = round ? expect[i] + half : expect[i];
+			size_t len = round ? strlen(p) : half;
+
+			if (write(fd[i][0], p, len) < 0 || (round && write(fd[i][0], "\r", 1) < 0)) {
+				perror("write");
+				return 1;
+			}
+		}
+		while (el_loop_run(loop, 100) > 0)
+			;
+	}
+
+	for (i = 0; i < SESSIONS; i++) {
+		snprintf(name, sizeof(name), "session-%d", i);
+		tests++;
+		if (!lines[i] || strcmp(lines[i], expect[i])) {
+			fprintf(stderr, "FAIL %-20s expected [%s] got [%s]\n", name, expect[i],
+				lines[i] ? lines[i] : "(null)");
+			fail++;
+		} else {
+			printf("PASS %-20s [%s]\n", name, lines[i]);
+		}
+
+		snprintf(name, sizeof(name), "echo-%d", i);
+		tests++;
+		if (!drained(fd[i][0], expect[i] + strlen(expect[i]) / 2)) {
+			fprintf(stderr, "FAIL %-20s no echo of [%s]\n", name, expect[i]);
+			fail++;
+		} else {
+			printf("PASS %-20s [%s]\n", name, expect[i]);
+		}
+	}
+
+	/* Hang up the first client */
+	close(fd[0][0]);
+	while (el_loop_run(loop, 100) > 0)
+		;
+
+	tests++;
+	if (eofs[0] != 1 || eofs[1] || eofs[2] || el_loop_del(loop, sess[0]) != -1) {
+		fprintf(stderr, "FAIL %-20s got %d %d %d\n", "hangup", eofs[0], eofs[1], eofs[2]);
+		fail++;
+	} else {
+		printf("PASS %-20s [session-0 removed]\n", "hangup");
+	}
+
+	/* The others leave from their handlers, the last one freed too */
+	if (write(fd[1][0], "quit\r", 5) < 0 || write(fd[2][0], "bye\r", 4) < 0) {
+		perror("write");
+		return 1;
+	}
+	while (el_loop_run(loop, 100) > 0)
+		;
+
+	tests++;
+	if (!lines[1] || strcmp(lines[1], "quit") || el_loop_del(loop, sess[1]) != -1 ||
+	    !noprompt(fd[1][0], "quit")) {
+		fprintf(stderr, "FAIL %-20s session-1 still prompted\n", "handler-del");
+		fail++;
+	} else {
+		printf("PASS %-20s [no new prompt]\n", "handler-del");
+	}
+
+	tests++;
+	if (!lines[2] || strcmp(lines[2], "bye") || sess[2] || !noprompt(fd[2][0], "bye") ||
+	    rl_line_buffer) {
+		fprintf(stderr, "FAIL %-20s session-2 or the default one prompted\n", "handler-free");
+		fail++;
+	} else {
+		printf("PASS %-20s [default session untouched]\n", "handler-free");
+	}
+
+	/* One client closes the output socket of its session, another shuts
+	 * down reading but types on.  Neither may spin the loop, or raise
+	 * SIGPIPE, and the first one's handler gets NULL. */
+	for (i = SESSIONS; i < SESSIONS + LOSERS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd[i]) ||
+		    (i == SESSIONS && socketpair(AF_UNIX, SOCK_STREAM, 0, out))) {
+			perror("socketpair");
+			return 77;
+		}
+		sess[i] = el_session_new(fd[i][1], i == SESSIONS ? out[1] : fd[i][1]);
+		id[i] = i;
+		el_session_set_data(sess[i], &id[i]);
+		if (!sess[i] || el_loop_add(loop, sess[i], "> ", handler)) {
+			perror("el_loop_add");
+			return 1;
+		}
+	}
+	while (el_loop_run(loop, 100) > 0)
+		;
+
+	close(out[0]);
+	shutdown(fd[SESSIONS + 1][0], SHUT_RD);
+	if (write(fd[SESSIONS + 1][0], "delta\r", 6) < 0) {
+		perror("write");
+		return 1;
+	}
+	while (el_loop_run(loop, 100) > 0)
+		;
+
+	tests++;
+	if (eofs[SESSIONS] != 1 || el_loop_del(loop, sess[SESSIONS]) != -1) {
+		fprintf(stderr, "FAIL %-20s handler got NULL %d times\n", "output-hangup", eofs[SESSIONS]);
+		fail++;
+	} else {
+		printf("PASS %-20s [session-%d removed]\n", "output-hangup", SESSIONS);
+	}
+
+	tests++;
+	if (!lines[SESSIONS + 1] || strcmp(lines[SESSIONS + 1], "delta")) {
+		fprintf(stderr, "FAIL %-20s expected [delta] got [%s]\n", "no-sigpipe",
+			lines[SESSIONS + 1] ? lines[SESSIONS + 1] : "(null)");
+		fail++;
+	} else {
+		printf("PASS %-20s [delta]\n", "no-sigpipe");
+	}
+
+	tests++;
+	if (wrong) {
+		fprintf(stderr, "FAIL %-20s %d calls without their session\n", "current", wrong);
+		fail++;
+	} else {
+		printf("PASS %-20s [session current in handler]\n", "current");
+	}
+
+	el_loop_free(loop);
+	close(out[1]);
+	for (i = 0; i < SESSIONS + LOSERS; i++) {
+		free(lines[i]);
+		el_session_free(sess[i]);
+		close(fd[i][1]);
+		if (i)
+			close(fd[i][0]);
+	}
+
+	printf("\nloop: %d tests, %d failures\n", tests, fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,278 @@
+/* Messages: threads posting with el_session_post() while a line is being
+ * edited.  In callback mode a burst from several threads must all come
+ * out, in order per thread, above the line, which is redrawn once for
+ * the whole batch.  A readline() blocked on a pty, with the message fd
+ * enabled, must show a message as it is posted, before the next key.
+ * Posted to NULL it goes to the default session, where every thread has
+ * its own with --enable-thread-local, so there NULL must be refused. */
+#define _DEFAULT_SOURCE		/* openpty(), cfmakeraw() under strict -std */
+#include <config.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#if defined(HAVE_PTY_H)
+# include <pty.h>
+#elif defined(HAVE_UTIL_H)
+# include <util.h>
+#elif defined(HAVE_LIBUTIL_H)
+# include <libutil.h>
+#endif
+
+#include "editline.h"
+
+#define THREADS  4
+#define MESSAGES 250
+
+static el_session_t *sess;
+static char out[65536];
+static size_t outlen;
+
+static void handler(char *line)
+{
+	free(line);
+}
+
+static void *poster(void *arg)
+{
+	char msg[32];
+	int i;
+
+	for (i = 0; i < MESSAGES; i++) {
+		snprintf(msg, sizeof(msg), "t%zu-%d", (size_t)arg, i);
+		if (el_session_post(sess, msg))
+			return (void *)1;
+	}
+
+	return NULL;
+}
+
+/* Read what fd has until 'expect' shows up, or a second of quiet */
+static int collect(int fd, const char *expect)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	ssize_t n;
+
+	while (!strstr(out, expect) && poll(&pfd, 1, 1000) > 0) {
+		n = read(fd, out + outlen, sizeof(out) - outlen - 1);
+		if (n <= 0)
+			break;
+		outlen += n;
+		out[outlen] = 0;
+	}
+
+	return strstr(out, expect) != NULL;
+}
+
+static int batch(void)
+{
+	pthread_t tid[THREADS];
+	int in[2], pipefd[2], next[THREADS] = { 0 };
+	int fail = 0, bad = 0, fd, redraws = 0;
+	char *p, *q;
+	size_t i;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) || pipe(pipefd)) {
+		perror("socketpair");
+		exit(77);
+	}
+
+	sess = el_session_new(in[1], pipefd[1]);
+	el_session_callback_handler_install(sess, "> ", handler);
+	el_session_callback_read_chars(sess, "abc", 3);
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&tid[i], NULL, poster, (void *)i);
+	for (i = 0; i < THREADS; i++) {
+		void *rc;
+
+		pthread_join(tid[i], &rc);
+		bad += rc != NULL;
+	}
+
+	/* All posted before the fd existed, it must be readable anyway */
+	fd = el_session_message_fd(sess);
+	if (fd < 0 || poll(&(struct pollfd){ .fd = fd, .events = POLLIN }, 1, 0) != 1) {
+		fprintf(stderr, "FAIL %-20s message fd not readable\n", "wakeup");
+		fail++;
+	} else {
+		printf("PASS %-20s [message fd readable]\n", "wakeup");
+	}
+
+	el_session_callback_read_char(sess);
+	collect(pipefd[0], "t3-249");
+
+	/* After the first prompt, every message in order, then one redraw */
+	p = strstr(out, "> abc");
+	for (q = p ? p + 5 : out; (q = strstr(q, "t")); q++) {
+		unsigned t;
+		int n;
+
+		if (sscanf(q, "t%u-%d", &t, &n) != 2 || t >= THREADS)
+			continue;
+		if (n != next[t]++)
+			bad++;
+	}
+	for (q = out; (q = strstr(q, "> abc")); q++)
+		redraws++;
+
+	for (i = 0; i < THREADS; i++) {
+		if (next[i] != MESSAGES)
+			bad++;
+	}
+	if (bad) {
+		fprintf(stderr, "FAIL %-20s messages lost or out of order\n", "batch");
+		fail++;
+	} else {
+		printf("PASS %-20s [%d messages in order]\n", "batch", THREADS * MESSAGES);
+	}
+
+	if (redraws != 2 || !strstr(strstr(out, "t3-249"), "> abc")) {
+		fprintf(stderr, "FAIL %-20s line drawn %d times\n", "redraw", redraws);
+		fail++;
+	} else {
+		printf("PASS %-20s [once for the batch]\n", "redraw");
+	}
+
+	el_session_free(sess);
+	close(in[0]);
+	close(in[1]);
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	return fail;
+}
+
+static int master;
+static int shown;
+
+static void *operator(void *arg)
+{
+	(void)arg;
+
+	collect(master, "> ");
+	el_session_post(sess, "from a thread");
+	shown = collect(master, "from a thread");
+
+	if (write(master, "line\r", 5) != 5)
+		return NULL;
+	collect(master, "line");
+
+	return NULL;
+}
+
+static int blocked(void)
+{
+	struct termios tio;
+	pthread_t tid;
+	char *line;
+	int slave, fail = 0;
+
+	/* No control chars, readline() takes its keys from these */
+	memset(&tio, 0, sizeof(tio));
+	cfmakeraw(&tio);
+	if (openpty(&master, &slave, NULL, &tio, NULL)) {
+		perror("openpty");
+		return 0;
+	}
+
+	outlen = 0;
+	out[0] = 0;
+	sess = el_session_new(slave, slave);
+	el_session_message_fd(sess);
+
+	pthread_create(&tid, NULL, operator, NULL);
+	line = el_session_readline(sess, "> ");
+	pthread_join(tid, NULL);
+
+	if (!shown) {
+		fprintf(stderr, "FAIL %-20s message waited for a key\n", "readline");
+		fail++;
+	} else if (!line || strcmp(line, "line")) {
+		fprintf(stderr, "FAIL %-20s got [%s]\n", "readline", line ? line : "(null)");
+		fail++;
+	} else {
+		printf("PASS %-20s [shown while blocked]\n", "readline");
+	}
+
+	el_free(line);
+	el_session_free(sess);
+	close(slave);
+	close(master);
+
+	return fail;
+}
+
+static void *poster_default(void *arg)
+{
+	(void)arg;
+
+	if (el_session_post(NULL, "to the default"))
+		return (void *)(size_t)errno;
+
+	return NULL;
+}
+
+static int default_session(void)
+{
+	pthread_t tid;
+	void *rc;
+	int pipefd[2], fail = 0;
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 0;
+	}
+
+	outlen = 0;
+	out[0] = 0;
+	rl_outstream = fdopen(pipefd[1], "w");
+	rl_callback_handler_install("> ", handler);
+
+	pthread_create(&tid, NULL, poster_default, NULL);
+	pthread_join(tid, &rc);
+	rl_callback_read_chars("a", 1);
+	collect(pipefd[0], "to the default");
+
+#ifdef EL_THREAD_LOCAL
+	if ((size_t)rc != EINVAL) {
+		fprintf(stderr, "FAIL %-20s NULL session accepted\n", "default");
+		fail++;
+	} else {
+		printf("PASS %-20s [NULL refused, thread-local]\n", "default");
+	}
+#else
+	if (rc || !strstr(out, "to the default")) {
+		fprintf(stderr, "FAIL %-20s message not shown\n", "default");
+		fail++;
+	} else {
+		printf("PASS %-20s [shown by the default session]\n", "default");
+	}
+#endif
+
+	rl_callback_handler_remove();
+	rl_uninitialize();
+	fclose(rl_outstream);
+	rl_outstream = NULL;
+	close(pipefd[0]);
+
+	return fail;
+}
+
+int main(void)
+{
+	int fail;
+
+	fail  = batch();
+	fail += blocked();
+	fail += default_session();
+
+	printf("\nmessage: 5 tests, %d failures\n", fail);
+	return fail ? 1 : 0;
+}
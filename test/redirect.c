@@ -0,0 +1,54 @@
+/* Redirected input: when stdin is not a tty, readline() returns one line
+ * per call from a file or pipe.  Input is read a chunk at a time, so what
+ * follows a newline must carry over to the next call, lines longer than
+ * a chunk must come through whole, and an incomplete last line is
+ * ignored, just like at a tty. */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "editline.h"
+
+static char big[10000];
+
+int main(void)
+{
+	const char *expect[] = { "first", "", "third line", big, "last", NULL };
+	FILE *fp;
+	size_t i;
+	int fail = 0;
+
+	memset(big, 'x', sizeof(big) - 1);
+
+	fp = tmpfile();
+	if (!fp) {
+		perror("tmpfile");
+		return 77;		/* SKIP: cannot create scratch file */
+	}
+	fprintf(fp, "first\n\nthird line\n%s\nlast\nincomplete", big);
+	fflush(fp);
+	rewind(fp);
+	if (dup2(fileno(fp), STDIN_FILENO) < 0) {
+		perror("dup2");
+		return 77;
+	}
+
+	for (i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+		char *line = readline("");
+
+		if ((!line || !expect[i]) ? line != expect[i] : strcmp(line, expect[i]) != 0) {
+			fprintf(stderr, "FAIL line-%-13zu expected %zu bytes, got %zd\n", i + 1,
+				expect[i] ? strlen(expect[i]) : 0, line ? (ssize_t)strlen(line) : -1);
+			fail++;
+		} else {
+			printf("PASS line-%-13zu [%zu bytes]\n", i + 1, line ? strlen(line) : 0);
+		}
+		free(line);
+	}
+
+	fclose(fp);
+	printf("\nredirect: %zu tests, %d failures\n", i, fail);
+	return fail ? 1 : 0;
+}
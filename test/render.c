@@ -0,0 +1,70 @@
+/* Damage-tracking redisplay: a keystroke redraws only what changed.
+ * Editing near the end of a long, wrapped line used to reprint the prompt
+ * and every byte up to the cursor; now it costs the shifted tail and a
+ * short cursor move, and jumping across rows takes a few control
+ * sequences instead of one backspace per column.  Near the start of the
+ * line the tail is shifted in place with ICH/DCH, about a dozen bytes
+ * per row instead of redrawing all of it, and a paste is drawn once, not
+ * once per character.  Keystrokes are measured by the output they cause
+ * once the line is on screen. */
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "editline.h"
+#include "eltest.h"
+
+#define WIDTH  40
+
+static char line[512];
+
+static int cost(const char *keys)
+{
+	static unsigned char out[16384];
+
+	return el_capture_keys(line, keys, WIDTH, out, sizeof(out));
+}
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		const char *keys;
+		int         budget;	/* bytes */
+	} cases[] = {
+		{ "delete-near-end", "\033" "20" "\002\004", 48  },	/* ESC 20 ^B, ^D */
+		{ "insert-near-end", "\033" "20" "\002X",     48  },	/* ESC 20 ^B, X  */
+		{ "home",            "\001",                  24  },	/* ^A            */
+		{ "insert-at-start", "\001X",                 128 },	/* ^A, X         */
+		{ "delete-at-start", "\001\004",              128 },	/* ^A, ^D        */
+		{ "paste-at-start",  "\001" "0123456789"
+				     "0123456789",         400 },	/* ^A, 20 chars  */
+	};
+	size_t i;
+	int fail = 0;
+
+	/* A terminal with ICH/DCH, as the tail shifts in place. */
+	setenv("TERM", "xterm", 1);
+
+	/* 300 columns of text, wrapped over eight rows. */
+	for (i = 0; i < 300; i++)
+		line[i] = 'a' + i % 26;
+	line[i] = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		int n = cost(cases[i].keys);
+
+		if (n < 0)
+			return 77;	/* SKIP: no pty */
+		if (n > cases[i].budget) {
+			fprintf(stderr, "FAIL %-18s %d bytes, budget %d\n", cases[i].name, n, cases[i].budget);
+			fail++;
+			continue;
+		}
+		printf("PASS %-18s [%d bytes]\n", cases[i].name, n);
+	}
+
+	printf("\nrender: %zu tests, %d failures\n", i, fail);
+	return fail ? 1 : 0;
+}
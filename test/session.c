@@ -0,0 +1,146 @@
+/* Sessions: two el_session_t, fed interleaved a few keys at a time, must
+ * each keep their own line in progress and their own history.  While a
+ * session is current the rl_* variables show its line, and its M-m
+ * setting, and the default session is left alone.  Not being terminals,
+ * they get the usual control chars: NUL, as telnet sends after CR, is
+ * no key and Ctrl-C only drops the line, it does not signal the
+ * process. */
+#include <config.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "editline.h"
+
+static char *lines[2][8];
+static size_t count[2];
+
+static void store(int n, char *line)
+{
+	if (count[n] < sizeof(lines[n]) / sizeof(lines[n][0]))
+		lines[n][count[n]++] = line;
+	else
+		free(line);
+}
+
+static void handler0(char *line) { store(0, line); }
+static void handler1(char *line) { store(1, line); }
+
+static int check(const char *name, const char *got, const char *expect)
+{
+	if (!got || strcmp(got, expect)) {
+		fprintf(stderr, "FAIL %-20s expected [%s] got [%s]\n", name, expect, got ? got : "(null)");
+		return 1;
+	}
+
+	printf("PASS %-20s [%s]\n", name, got);
+	return 0;
+}
+
+int main(void)
+{
+	el_session_t *s[2], *prev;
+	int fail = 0, tests = 0;
+	int fd, n;
+	size_t i;
+
+	fd = open("/dev/null", O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 77;
+	}
+
+	for (n = 0; n < 2; n++) {
+		s[n] = el_session_new(fd, fd);
+		if (!s[n]) {
+			perror("el_session_new");
+			return 1;
+		}
+	}
+
+	el_session_callback_handler_install(s[0], "", handler0);
+	el_session_callback_handler_install(s[1], "", handler1);
+
+	el_session_callback_read_chars(s[0], "hel", 3);
+	el_session_callback_read_chars(s[1], "wor", 3);
+
+	prev = el_session_set(s[0]);
+	tests++;
+	fail += check("line-in-progress", rl_line_buffer, "hel");
+	el_session_set(prev);
+
+	el_session_callback_read_chars(s[0], "lo\r", 3);
+	el_session_callback_read_chars(s[1], "ld\r", 3);
+
+	/* Ctrl-P recalls the last line of the session's own history */
+	el_session_callback_read_chars(s[1], "\020\r", 2);
+	el_session_callback_read_chars(s[0], "\020\r", 2);
+
+	/* M-. inserts the last argument of the previous line, M-1 M-. the second */
+	el_session_callback_read_chars(s[0], "one two three\r\033.\r", 17);
+	el_session_callback_read_chars(s[1], "a b c\r\0331\033.\r", 11);
+
+	el_session_callback_read_chars(s[0], "ok\r\0", 4);
+	el_session_callback_read_chars(s[0], "gone\003", 5);
+	el_session_callback_read_chars(s[0], "a\010b\025cd\r", 8);
+
+	/* M-m toggles how 8-bit chars show, in that session only */
+	el_session_callback_read_chars(s[1], "\033m", 2);
+	prev = el_session_set(s[1]);
+	n = rl_meta_chars;
+	el_session_set(s[0]);
+	tests++;
+	if (n != 1 || rl_meta_chars) {
+		fprintf(stderr, "FAIL %-20s got %d in session-1, %d in session-0\n", "meta-chars", n, rl_meta_chars);
+		fail++;
+	} else {
+		printf("PASS %-20s [session-1 only]\n", "meta-chars");
+	}
+	el_session_set(prev);
+
+	el_session_callback_handler_remove(s[0]);
+	el_session_callback_handler_remove(s[1]);
+
+	tests += 4;
+	fail += check("session-0", lines[0][0], "hello");
+	fail += check("session-1", lines[1][0], "world");
+	fail += check("history-0", lines[0][1], "hello");
+	fail += check("history-1", lines[1][1], "world");
+
+	tests += 2;
+	fail += check("last-argument-0", lines[0][3], "three");
+	fail += check("last-argument-1", lines[1][3], "b");
+
+	tests += 3;
+	fail += check("telnet-nul", lines[0][4], "ok");
+	fail += check("interrupt", lines[0][5], "");
+	fail += check("erase-kill", lines[0][6], "cd");
+
+	tests++;
+	if (count[0] != 7 || count[1] != 4) {
+		fprintf(stderr, "FAIL %-20s expected 7 + 4 got %zu + %zu\n", "lines", count[0], count[1]);
+		fail++;
+	} else {
+		printf("PASS %-20s [7 + 4]\n", "lines");
+	}
+
+	tests++;
+	if (rl_line_buffer || rl_meta_chars) {
+		fprintf(stderr, "FAIL %-20s has a line buffer, or meta chars\n", "default-session");
+		fail++;
+	} else {
+		printf("PASS %-20s [untouched]\n", "default-session");
+	}
+
+	for (n = 0; n < 2; n++) {
+		for (i = 0; i < count[n]; i++)
+			free(lines[n][i]);
+		el_session_free(s[n]);
+	}
+	close(fd);
+
+	printf("\nsession: %d tests, %d failures\n", tests, fail);
+	return fail ? 1 : 0;
+}
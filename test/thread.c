@@ -0,0 +1,122 @@
+/* Threads: built with --enable-thread-local, threads each editing on the
+ * default session, a key at a time and all at once, must each see only
+ * their own line in rl_line_buffer, and recall their own history.  A key
+ * sequence bound before the threads start works in all of them. */
+#include <config.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "editline.h"
+
+#define THREADS 4
+#define ROUNDS  200
+
+#ifdef EL_THREAD_LOCAL
+static const char *words[THREADS] = { "alpha", "bravo", "charlie", "delta" };
+static pthread_barrier_t start;
+
+static __thread char *got;
+static __thread int lines;
+
+static el_status_t key_tag(void)
+{
+	rl_insert_text("[key]");
+	return CSmove;
+}
+
+static void handler(char *line)
+{
+	free(got);
+	got = line;
+	lines++;
+}
+
+static void *worker(void *arg)
+{
+	const char *word = words[(size_t)arg];
+	size_t i, len = strlen(word);
+	int round, wrong = 0;
+
+	rl_instream  = fopen("/dev/null", "r");
+	rl_outstream = fopen("/dev/null", "w");
+	if (!rl_instream || !rl_outstream)
+		return (void *)-1;
+
+	pthread_barrier_wait(&start);
+	rl_callback_handler_install("> ", handler);
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < len; i++) {
+			rl_callback_read_chars(&word[i], 1);
+			if (!rl_line_buffer || strncmp(rl_line_buffer, word, i + 1) || rl_end != (int)i + 1)
+				wrong++;
+			sched_yield();
+		}
+		rl_callback_read_chars("\r", 1);
+		if (!got || strcmp(got, word))
+			wrong++;
+
+		/* Ctrl-P recalls the last line of this thread */
+		rl_callback_read_chars("\020\r", 2);
+		if (!got || strcmp(got, word))
+			wrong++;
+	}
+
+	/* C-x C-s, bound in main() */
+	rl_callback_read_chars("\030\023\r", 3);
+	if (!got || strcmp(got, "[key]"))
+		wrong++;
+	rl_callback_handler_remove();
+
+	if (lines != 2 * ROUNDS + 1)
+		wrong++;
+
+	free(got);
+	rl_uninitialize();
+	fclose(rl_instream);
+	fclose(rl_outstream);
+
+	return (void *)(size_t)wrong;
+}
+
+int main(void)
+{
+	pthread_t tid[THREADS];
+	int fail = 0;
+	size_t i;
+
+	el_bind_keyseq("\030\023", key_tag);
+	pthread_barrier_init(&start, NULL, THREADS);
+	for (i = 0; i < THREADS; i++) {
+		if (pthread_create(&tid[i], NULL, worker, (void *)i)) {
+			perror("pthread_create");
+			return 77;
+		}
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		char name[32];
+		void *wrong;
+
+		pthread_join(tid[i], &wrong);
+		snprintf(name, sizeof(name), "thread-%zu", i);
+		if (wrong) {
+			fprintf(stderr, "FAIL %-20s %zd wrong of %d lines\n", name, (ssize_t)wrong, ROUNDS);
+			fail++;
+		} else {
+			printf("PASS %-20s [%d x %s]\n", name, ROUNDS, words[i]);
+		}
+	}
+	pthread_barrier_destroy(&start);
+
+	printf("\nthread: %d tests, %d failures\n", THREADS, fail);
+	return fail ? 1 : 0;
+}
+#else
+int main(void)
+{
+	return 77;	/* SKIP: built without --enable-thread-local */
+}
+#endif
@@ -11,6 +11,10 @@ static const struct testcase cases[] = {
 	{ "utf8-insert",       "\303\251\342\202\254\r",   "\303\251\342\202\254", NULL },
 	{ "utf8-back-glyph",   "a\303\251b\002\002X\r",    "aX\303\251b"  , NULL        },
 	{ "utf8-fwd-glyph",    "\303\251ab\001\006X\r",    "\303\251Xab"  , NULL        },
+	/* A glyph is inserted whole, so a repeat count repeats the glyph */
+	{ "utf8-repeat",       "\0333\342\202\254\r",     "\342\202\254\342\202\254\342\202\254", NULL },
+	/* Bytes that are not valid UTF-8, e.g. Latin-1, go in as they are */
+	{ "utf8-invalid",      "a\351b\340\200\r",        "a\351b\340\200", NULL },
 #ifdef CONFIG_ANSI_ARROWS
 	{ "utf8-arrow-left",   "\303\251\033[DX\r",        "X\303\251"    , NULL        },
 #endif